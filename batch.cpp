@@ -0,0 +1,253 @@
+#include "batch.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include "listing.h"
+#include "walker.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#define write _write
+#define STDOUT_FILENO 1
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Output is gathered up to this much before each write(), so a listing of
+// millions of entries costs a few hundred system calls, not millions
+static const size_t OUTPUT_BUFFER_BYTES = 1u << 20;
+
+enum ListFormat {
+    LIST_TSV,
+    LIST_JSON
+};
+
+// Standard output, written in big blocks. Entries are formatted by the
+// walker threads and appended under a lock, so lines never interleave.
+class OutputBuffer {
+public:
+    OutputBuffer() { buffer.reserve(OUTPUT_BUFFER_BYTES); }
+    ~OutputBuffer() { flush(); }
+
+    void append(const std::string &text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer += text;
+        if (buffer.size() >= OUTPUT_BUFFER_BYTES) {
+            writeOut();
+        }
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeOut();
+    }
+
+    // True if a write failed, e.g. because the disk is full
+    bool failed() const { return writeFailed; }
+
+private:
+    void writeOut() {
+        size_t done = 0;
+        while (done < buffer.size() && !writeFailed) {
+            long n = write(STDOUT_FILENO, buffer.data() + done, (unsigned)(buffer.size() - done));
+            if (n > 0) {
+                done += n;
+            }
+#ifndef _WIN32
+            else if (n < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            else {
+                writeFailed = true;
+            }
+        }
+        buffer.clear();
+    }
+
+    std::mutex mutex;
+    std::string buffer;
+    bool writeFailed = false;
+};
+
+static const char *typeName(uint8_t type) {
+    switch (type) {
+    case ENTRY_FILE: return "file";
+    case ENTRY_DIR: return "dir";
+    case ENTRY_LINK: return "link";
+    case ENTRY_OTHER: return "other";
+    default: return "unknown";
+    }
+}
+
+// Append a path for a TSV line: tabs, newlines, carriage returns and
+// backslashes are escaped so that every entry stays one line of five fields
+static void appendTsvPath(std::string &out, const std::string &path) {
+    for (char c : path) {
+        switch (c) {
+        case '\t': out += "\\t"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\\': out += "\\\\"; break;
+        default: out += c;
+        }
+    }
+}
+
+// Append a path as a JSON string. Names are passed through as the bytes the
+// file system has, which is UTF-8 on any sensibly set up system.
+static void appendJsonString(std::string &out, const std::string &text) {
+    out += '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+// One output line for an entry at path, relative to the listed directory
+static void formatEntry(std::string &out, ListFormat format, const std::string &path, const WalkEntry &entry) {
+    char fields[96];
+    out.clear();
+    if (format == LIST_TSV) {
+        // type, size, mtime, mode, path; fields the entry couldn't be stat'ed for are empty
+        if (entry.hasStat) {
+            snprintf(fields, sizeof(fields), "%s\t%lld\t%lld\t%04o\t", typeName(entry.type),
+                     (long long)entry.size, (long long)entry.mtime, (unsigned)(entry.mode & 07777));
+        } else {
+            snprintf(fields, sizeof(fields), "%s\t\t\t\t", typeName(entry.type));
+        }
+        out += fields;
+        appendTsvPath(out, path);
+        out += '\n';
+    } else {
+        out += "{\"path\":";
+        appendJsonString(out, path);
+        snprintf(fields, sizeof(fields), ",\"type\":\"%s\"", typeName(entry.type));
+        out += fields;
+        if (entry.hasStat) {
+            snprintf(fields, sizeof(fields), ",\"size\":%lld,\"mtime\":%lld,\"mode\":\"%04o\"",
+                     (long long)entry.size, (long long)entry.mtime, (unsigned)(entry.mode & 07777));
+            out += fields;
+        }
+        out += "}\n";
+    }
+}
+
+// Absolute form of path, with no "." or ".." in it, or "" if it doesn't exist
+static std::string absolutePath(const std::string &path) {
+#ifdef _WIN32
+    char resolved[_MAX_PATH];
+    return _fullpath(resolved, path.c_str(), sizeof(resolved)) ? resolved : "";
+#else
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) ? resolved : "";
+#endif
+}
+
+static int usage() {
+    fprintf(stderr, "usage: traverse [--list [DIR] [--format=tsv|json] [--recursive]]\n"
+                    "\n"
+                    "  --list DIR      print the entries of DIR (default: the current directory)\n"
+                    "                  and exit, one per line, without the user interface\n"
+                    "  --format=tsv    type, size, mtime, mode and path separated by tabs (default)\n"
+                    "  --format=json   one JSON object per line\n"
+                    "  --recursive     list the whole tree below DIR, in no particular order\n");
+    return 2;
+}
+
+int runBatch(int argc, char **argv) {
+    bool list = false;
+    bool recursive = false;
+    ListFormat format = LIST_TSV;
+    std::string dir = ".";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--list") {
+            list = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                dir = argv[++i];
+            }
+        } else if (arg == "--recursive" || arg == "-r") {
+            recursive = true;
+        } else if (arg == "--format=tsv") {
+            format = LIST_TSV;
+        } else if (arg == "--format=json") {
+            format = LIST_JSON;
+        } else {
+            return usage();
+        }
+    }
+    if (!list) {
+        return usage();
+    }
+
+    std::string root = absolutePath(dir);
+    struct stat st;
+    if (root.empty() || stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "traverse: %s: %s\n", dir.c_str(), root.empty() ? strerror(errno) : "Not a directory");
+        return 1;
+    }
+
+    // The same walk the browser sizes and searches with: entries are stat'ed
+    // without following links. No tree index: a directory's stamp doesn't
+    // change when a file in it is written to, so its sizes and times could
+    // be long out of date, and scripts would have no way to tell.
+    WalkOptions options;
+    options.statEntries = true;
+    options.maxDepth = recursive ? -1 : 1;
+
+    // Directories that can't be read are reported as find does, and make
+    // the run fail, so that a partial listing isn't taken for a whole one
+    std::mutex errorMutex;
+    bool incomplete = false;
+    options.onError = [&](const std::string &path, int error) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        fprintf(stderr, "traverse: %s: %s\n", path.c_str(), strerror(error));
+        incomplete = true;
+    };
+
+    OutputBuffer output;
+    std::atomic<bool> cancelled{false};
+    walkTrees({root}, options, [&](const WalkEntry &entry) {
+        static thread_local std::string path;
+        static thread_local std::string line;
+        // Paths are relative to the listed directory; the walker's start with root
+        path.clear();
+        size_t skip = root.size();
+        while (skip < entry.dirPath->size() && (*entry.dirPath)[skip] == '/') {
+            skip++;
+        }
+        if (skip < entry.dirPath->size()) {
+            path.append(*entry.dirPath, skip, std::string::npos);
+            path += '/';
+        }
+        path.append(entry.name, entry.nameLength);
+        formatEntry(line, format, path, entry);
+        output.append(line);
+    }, cancelled);
+    output.flush();
+
+    if (output.failed()) {
+        fprintf(stderr, "traverse: writing the listing failed\n");
+        return 1;
+    }
+    return incomplete ? 1 : 0;
+}
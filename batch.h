@@ -0,0 +1,13 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+// Run traverse without its user interface, as told by the command line:
+//
+//   traverse --list [DIR] [--format=tsv|json] [--recursive]
+//
+// lists DIR (the current directory by default) on standard output, one
+// entry per line, using walkTrees() and the tree index like the browser
+// does. Returns the exit status.
+int runBatch(int argc, char **argv);
+
+#endif // BATCH_H_INCLUDED
@@ -0,0 +1,406 @@
+// Benchmarks for the paths that decide how traverse feels: reading big
+// directories, walking big trees, sorting and filtering listings, redrawing
+// the listing and opening large files. Built as the Bench target in place of
+// main.cpp; run as
+//
+//   traverse-bench [--dir=PATH] [--sizes=10000,100000,1000000] [--text-mb=16,256] [--runs=5]
+//
+// Synthetic trees and files are generated under PATH the first time and
+// kept for later runs. Results go to standard output as JSON, progress to
+// standard error.
+
+#include <ncursesw/ncurses.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "listing.h"
+#include "view.h"
+#include "viewer.h"
+#include "walker.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#define mkdir(path, mode) _mkdir(path)
+#define pipe(fds) _pipe(fds, 4096, _O_BINARY)
+#define setenv(name, value, overwrite) _putenv_s(name, value)
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of the virtual terminal the redraw and viewer benchmarks draw on
+static const int BENCH_LINES = 50;
+static const int BENCH_COLUMNS = 200;
+
+// Frames drawn per redraw run, each a page further down the listing
+static const int REDRAW_FRAMES = 100;
+
+// Files per directory and subdirectories per directory of the deep trees
+static const int DEEP_FILES = 16;
+static const int DEEP_FANOUT = 2;
+
+// Extensions given to the generated files in turn, for sorting by type
+static const char *const EXTENSIONS[] = {".txt", ".cpp", ".h", ".log", ".md", ""};
+
+struct BenchResult {
+    std::string name;     // what was timed
+    std::string subject;  // what it was timed on
+    uint64_t items;       // entries, frames or bytes, as fits the benchmark
+    int runs;
+    double firstMs;       // the first run, which may have started cold
+    double minMs;
+    double medianMs;
+};
+
+static std::vector<BenchResult> results;
+static int benchRuns = 5;
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Time body benchRuns times, each after setup, which isn't timed
+static void measure(const std::string &name, const std::string &subject, uint64_t items,
+                    const std::function<void()> &setup, const std::function<void()> &body) {
+    std::vector<double> times;
+    for (int run = 0; run < benchRuns; run++) {
+        if (setup) {
+            setup();
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body();
+        times.push_back(millisecondsSince(start));
+    }
+    BenchResult result;
+    result.name = name;
+    result.subject = subject;
+    result.items = items;
+    result.runs = benchRuns;
+    result.firstMs = times[0];
+    std::sort(times.begin(), times.end());
+    result.minMs = times[0];
+    result.medianMs = times[times.size() / 2];
+    results.push_back(result);
+    fprintf(stderr, "  %-22s %-14s %10.3f ms\n", name.c_str(), subject.c_str(), result.medianMs);
+}
+
+static bool exists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static bool createFile(const std::string &path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static std::string fileName(uint64_t i) {
+    char name[32];
+    snprintf(name, sizeof(name), "file%llu%s", (unsigned long long)i,
+             EXTENSIONS[i % (sizeof(EXTENSIONS) / sizeof(EXTENSIONS[0]))]);
+    return name;
+}
+
+// Marks a generated tree or file as complete, so an interrupted run makes it again
+static std::string donePath(const std::string &path) {
+    return path + ".done";
+}
+
+// One directory holding count empty files
+static bool makeWideTree(const std::string &path, uint64_t count) {
+    if (exists(donePath(path))) {
+        return true;
+    }
+    fprintf(stderr, "generating %s\n", path.c_str());
+    mkdir(path.c_str(), 0755);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!createFile(path + "/" + fileName(i))) {
+            return false;
+        }
+    }
+    return createFile(donePath(path));
+}
+
+// A tree of about count entries, filled breadth first: every directory holds
+// DEEP_FILES files and DEEP_FANOUT subdirectories
+static bool makeDeepTree(const std::string &path, uint64_t count) {
+    if (exists(donePath(path))) {
+        return true;
+    }
+    fprintf(stderr, "generating %s\n", path.c_str());
+    mkdir(path.c_str(), 0755);
+    std::deque<std::string> pending = {path};
+    uint64_t made = 0;
+    while (!pending.empty() && made < count) {
+        std::string dir = pending.front();
+        pending.pop_front();
+        for (int i = 0; i < DEEP_FILES && made < count; i++, made++) {
+            if (!createFile(dir + "/" + fileName(made))) {
+                return false;
+            }
+        }
+        for (int i = 0; i < DEEP_FANOUT && made < count; i++, made++) {
+            std::string sub = dir + "/dir" + std::to_string(made);
+            if (mkdir(sub.c_str(), 0755) != 0) {
+                return false;
+            }
+            pending.push_back(sub);
+        }
+    }
+    return createFile(donePath(path));
+}
+
+// A text file of about megabytes MB, with lines of varying length
+static bool makeTextFile(const std::string &path, uint64_t megabytes) {
+    if (exists(donePath(path))) {
+        return true;
+    }
+    fprintf(stderr, "generating %s\n", path.c_str());
+    FILE *out = fopen(path.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    std::string line;
+    uint64_t written = 0;
+    uint32_t seed = 12345;
+    for (uint64_t n = 0; written < (megabytes << 20); n++) {
+        seed = seed * 1103515245 + 12345;
+        line = "line " + std::to_string(n) + ":";
+        size_t words = (seed >> 16) % 24;
+        for (size_t i = 0; i < words; i++) {
+            line += " lorem";
+        }
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), out);
+        written += line.size();
+    }
+    bool ok = fclose(out) == 0;
+    return ok && createFile(donePath(path));
+}
+
+// A terminal that draws into /dev/null and reads from a pipe that the
+// benchmarks write keys into, so drawing costs what it does on a real one
+// minus the terminal itself
+static int keyPipe[2] = {-1, -1};
+
+static bool openVirtualTerminal() {
+    char lines[16], columns[16];
+    snprintf(lines, sizeof(lines), "%d", BENCH_LINES);
+    snprintf(columns, sizeof(columns), "%d", BENCH_COLUMNS);
+    setenv("LINES", lines, 1);
+    setenv("COLUMNS", columns, 1);
+    if (pipe(keyPipe) != 0) {
+        return false;
+    }
+    FILE *in = fdopen(keyPipe[0], "r");
+    FILE *out = fopen("/dev/null", "w");
+    if (!in || !out || !newterm("xterm", out, in)) {
+        return false;
+    }
+    noecho();
+    curs_set(0);
+    keypad(stdscr, TRUE);
+    set_escdelay(0);  // ESC is the only key the benchmarks send
+    return true;
+}
+
+// Draw a page of the view starting at topRow the way drawListingRow() in
+// main.cpp does, with the first row highlighted
+static void drawPage(const DirListing &listing, const ListingView &view, int topRow) {
+    char row[512];
+    for (int line = 1; line < LINES - 1; line++) {
+        move(line, 0);
+        clrtoeol();
+        int position = topRow + line - 1;
+        if (position >= (int)view.size()) {
+            continue;
+        }
+        const DirEntry &entry = listing.entries[view.order[position]];
+        int length = formatEntry(listing, entry, row, sizeof(row));
+        attr_t attributes = line == 1 ? A_REVERSE : 0;
+        attron(attributes);
+        addnstr(row, std::min(length, COLS));
+        attroff(attributes);
+    }
+    mvprintw(LINES - 1, 0, "%d/%d", topRow + 1, (int)view.size());
+    refresh();
+}
+
+static void benchWideTree(const std::string &path, uint64_t count, bool terminal) {
+    std::string subject = "wide-" + std::to_string(count);
+    DirListing listing;
+    measure("getDirectoryContents", subject, count, nullptr, [&] {
+        listing = getDirectoryContents(path);
+    });
+    measure("fillMetadata", subject, count, [&] {
+        listing = getDirectoryContents(path);
+    }, [&] {
+        fillMetadata(listing, 0, listing.entries.size());
+    });
+
+    ListingView view;
+    static const char *const sortNames[SORT_MODE_COUNT] = {"sortView.name", "sortView.size", "sortView.mtime",
+                                                           "sortView.type"};
+    for (int mode = 0; mode < SORT_MODE_COUNT; mode++) {
+        // Name keys are kept from one sort to the next, as in the browser; the first run pays for them
+        view.clear();
+        view.mode = (SortMode)mode;
+        measure(sortNames[mode], subject, count, nullptr, [&] {
+            sortView(view, listing);
+        });
+    }
+    view.mode = SORT_NAME;
+    sortView(view, listing);
+    measure("setFilter", subject, count, [&] {
+        setFilter(view, listing, "");
+    }, [&] {
+        setFilter(view, listing, "1");
+        setFilter(view, listing, "12");
+        setFilter(view, listing, "123");
+    });
+    setFilter(view, listing, "");
+
+    if (terminal) {
+        int pageRows = LINES - 2;
+        measure("redraw", subject, REDRAW_FRAMES, [&] {
+            clear();
+            refresh();
+        }, [&] {
+            for (int frame = 0; frame < REDRAW_FRAMES; frame++) {
+                drawPage(listing, view, (int)((uint64_t)frame * pageRows % std::max<size_t>(1, view.size())));
+            }
+        });
+    }
+}
+
+static void benchDeepTree(const std::string &path, uint64_t count) {
+    std::string subject = "deep-" + std::to_string(count);
+    std::atomic<bool> cancelled{false};
+    std::atomic<uint64_t> seen{0};
+    WalkOptions options;
+    measure("walkTrees", subject, count, nullptr, [&] {
+        walkTrees({path}, options, [&](const WalkEntry &) { seen++; }, cancelled);
+    });
+    options.statEntries = true;
+    measure("walkTrees.stat", subject, count, nullptr, [&] {
+        walkTrees({path}, options, [&](const WalkEntry &) { seen++; }, cancelled);
+    });
+}
+
+// Open the file in the viewer with ESC already waiting, and the key that
+// dismisses "Returning to directory view", so the call returns right after
+// the first screen has been drawn
+static void benchViewer(const std::string &path, uint64_t megabytes) {
+    std::string subject = "text-" + std::to_string(megabytes) + "M";
+    measure("displayFileContent", subject, megabytes << 20, [&] {
+        clear();
+        refresh();
+        if (write(keyPipe[1], "\x1b\x1b", 2) != 2) {
+            perror("write");
+        }
+    }, [&] {
+        displayFileContent(path);
+    });
+}
+
+static void writeJson() {
+    printf("{\n  \"lines\": %d,\n  \"columns\": %d,\n  \"walker_threads\": %u,\n  \"results\": [\n", BENCH_LINES,
+           BENCH_COLUMNS, walkerThreads());
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &result = results[i];
+        printf("    {\"name\": \"%s\", \"subject\": \"%s\", \"items\": %llu, \"runs\": %d, "
+               "\"first_ms\": %.3f, \"min_ms\": %.3f, \"median_ms\": %.3f}%s\n",
+               result.name.c_str(), result.subject.c_str(), (unsigned long long)result.items, result.runs,
+               result.firstMs, result.minMs, result.medianMs, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+// Parse a comma separated list of numbers
+static std::vector<uint64_t> parseList(const char *text) {
+    std::vector<uint64_t> values;
+    while (*text) {
+        char *end;
+        uint64_t value = strtoull(text, &end, 10);
+        if (end == text) {
+            break;
+        }
+        values.push_back(value);
+        text = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+int main(int argc, char **argv) {
+    const char *tmp = getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/traverse-bench";
+    std::vector<uint64_t> sizes = {10000, 100000, 1000000};
+    std::vector<uint64_t> textSizes = {16, 256};
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--dir=", 6) == 0) {
+            dir = argv[i] + 6;
+        } else if (strncmp(argv[i], "--sizes=", 8) == 0) {
+            sizes = parseList(argv[i] + 8);
+        } else if (strncmp(argv[i], "--text-mb=", 10) == 0) {
+            textSizes = parseList(argv[i] + 10);
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            benchRuns = std::max(1, atoi(argv[i] + 7));
+        } else {
+            fprintf(stderr, "usage: %s [--dir=PATH] [--sizes=N,...] [--text-mb=N,...] [--runs=N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    mkdir(dir.c_str(), 0755);
+    // The viewer's line index cache goes here too, rather than into the user's
+    std::string cache = dir + "/cache";
+    mkdir(cache.c_str(), 0755);
+    setenv("XDG_CACHE_HOME", cache.c_str(), 1);
+
+    for (uint64_t count : sizes) {
+        if (!makeWideTree(dir + "/wide-" + std::to_string(count), count) ||
+            !makeDeepTree(dir + "/deep-" + std::to_string(count), count)) {
+            perror(("generating trees in " + dir).c_str());
+            return 1;
+        }
+    }
+    for (uint64_t megabytes : textSizes) {
+        if (!makeTextFile(dir + "/text-" + std::to_string(megabytes) + "M.txt", megabytes)) {
+            perror(("generating files in " + dir).c_str());
+            return 1;
+        }
+    }
+
+    bool terminal = openVirtualTerminal();
+    if (!terminal) {
+        fprintf(stderr, "no virtual terminal; skipping the redraw and viewer benchmarks\n");
+    }
+    for (uint64_t count : sizes) {
+        benchWideTree(dir + "/wide-" + std::to_string(count), count, terminal);
+        benchDeepTree(dir + "/deep-" + std::to_string(count), count);
+    }
+    if (terminal) {
+        for (uint64_t megabytes : textSizes) {
+            benchViewer(dir + "/text-" + std::to_string(megabytes) + "M.txt", megabytes);
+        }
+        endwin();
+    }
+
+    writeJson();
+    return 0;
+}
@@ -0,0 +1,414 @@
+#include "compressed.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "scan.h"
+
+#include <lzma.h>
+#include <zlib.h>
+#include <zstd.h>
+
+// Bigger slices don't fit the 32-bit lengths of the zlib API
+static const uint64_t INPUT_SLICE = 1ull << 30;
+
+// How much is decoded per step()
+static const size_t DECODE_STEP = 1u << 20;
+
+// Text decoded between checkpoints, to begin with
+static const uint64_t CHECKPOINT_BYTES = 4ull << 20;
+
+Compression detectCompression(const char *data, uint64_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+        return COMPRESSION_GZIP;
+    }
+    if (size >= 6 && memcmp(bytes, "\xfd" "7zXZ\0", 6) == 0) {
+        return COMPRESSION_XZ;
+    }
+    if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+const char *compressionName(Compression format) {
+    switch (format) {
+    case COMPRESSION_GZIP:
+        return "gzip";
+    case COMPRESSION_XZ:
+        return "xz";
+    case COMPRESSION_ZSTD:
+        return "zstd";
+    default:
+        return "";
+    }
+}
+
+StreamDecoder::~StreamDecoder() {
+    release();
+}
+
+void StreamDecoder::release() {
+    if (!state) {
+        return;
+    }
+    switch (format) {
+    case COMPRESSION_GZIP:
+        inflateEnd((z_stream *)state);
+        delete (z_stream *)state;
+        break;
+    case COMPRESSION_XZ:
+        lzma_end((lzma_stream *)state);
+        delete (lzma_stream *)state;
+        break;
+    case COMPRESSION_ZSTD:
+        ZSTD_freeDStream((ZSTD_DStream *)state);
+        break;
+    default:
+        break;
+    }
+    state = nullptr;
+}
+
+bool StreamDecoder::start(Compression format, const char *input, uint64_t inputSize, uint64_t offset) {
+    release();
+    this->format = format;
+    this->input = input;
+    this->inputSize = inputSize;
+    position = std::min(offset, inputSize);
+    boundary = false;
+    members = 0;
+    end = false;
+    error = false;
+
+    switch (format) {
+    case COMPRESSION_GZIP: {
+        z_stream *stream = new z_stream();
+        if (inflateInit2(stream, 15 + 16) != Z_OK) {  // +16: expect a gzip header
+            delete stream;
+            break;
+        }
+        state = stream;
+        break;
+    }
+    case COMPRESSION_XZ: {
+        lzma_stream *stream = new lzma_stream;
+        *stream = LZMA_STREAM_INIT;
+        if (lzma_stream_decoder(stream, UINT64_MAX, 0) != LZMA_OK) {
+            delete stream;
+            break;
+        }
+        state = stream;
+        break;
+    }
+    case COMPRESSION_ZSTD:
+        state = ZSTD_createDStream();
+        if (state) {
+            ZSTD_initDStream((ZSTD_DStream *)state);
+        }
+        break;
+    default:
+        break;
+    }
+
+    memberOutput = false;
+    if (!state) {
+        end = error = true;
+    }
+    return state != nullptr;
+}
+
+bool StreamDecoder::copyFrom(const StreamDecoder &other) {
+    if (other.format == COMPRESSION_GZIP && other.state) {
+        release();
+        z_stream *stream = new z_stream();
+        if (inflateCopy(stream, (z_stream *)other.state) != Z_OK) {
+            delete stream;
+            end = error = true;
+            return false;
+        }
+        state = stream;
+        format = other.format;
+        input = other.input;
+        inputSize = other.inputSize;
+        position = other.position;
+        boundary = other.boundary;
+        members = other.members;
+        memberOutput = other.memberOutput;
+        end = other.end;
+        error = other.error;
+        return true;
+    }
+    return false;
+}
+
+// Move on to the member or frame after the one that just ended
+bool StreamDecoder::beginMember() {
+    boundary = false;
+    memberOutput = false;
+    switch (format) {
+    case COMPRESSION_GZIP:
+        return inflateReset((z_stream *)state) == Z_OK;
+    case COMPRESSION_XZ:
+        // Streams may be followed by padding in multiples of four zero bytes
+        while (position < inputSize && input[position] == '\0') {
+            position++;
+        }
+        lzma_end((lzma_stream *)state);
+        *(lzma_stream *)state = LZMA_STREAM_INIT;
+        return lzma_stream_decoder((lzma_stream *)state, UINT64_MAX, 0) == LZMA_OK;
+    default:
+        return true;  // zstd streams carry on into the next frame by themselves
+    }
+}
+
+size_t StreamDecoder::decode(char *out, size_t capacity) {
+    size_t produced = 0;
+    while (produced < capacity && !end) {
+        if (position >= inputSize) {
+            end = true;  // complete, or truncated: either way all there is has been shown
+            break;
+        }
+        if (boundary && !beginMember()) {
+            end = error = true;
+            break;
+        }
+
+        uint64_t slice = std::min(inputSize - position, INPUT_SLICE);
+        size_t consumed = 0;
+        size_t made = 0;
+        bool memberEnded = false;
+        bool corrupt = false;
+        switch (format) {
+        case COMPRESSION_GZIP: {
+            z_stream *stream = (z_stream *)state;
+            stream->next_in = (Bytef *)(input + position);
+            stream->avail_in = (uInt)slice;
+            stream->next_out = (Bytef *)(out + produced);
+            stream->avail_out = (uInt)std::min(capacity - produced, (size_t)INPUT_SLICE);
+            int status = inflate(stream, Z_NO_FLUSH);
+            consumed = (size_t)slice - stream->avail_in;
+            made = (capacity - produced) - stream->avail_out;
+            memberEnded = status == Z_STREAM_END;
+            corrupt = status != Z_OK && status != Z_STREAM_END && !(status == Z_BUF_ERROR && consumed + made > 0);
+            break;
+        }
+        case COMPRESSION_XZ: {
+            lzma_stream *stream = (lzma_stream *)state;
+            stream->next_in = (const uint8_t *)(input + position);
+            stream->avail_in = (size_t)slice;
+            stream->next_out = (uint8_t *)(out + produced);
+            stream->avail_out = capacity - produced;
+            lzma_ret status = lzma_code(stream, position + slice >= inputSize ? LZMA_FINISH : LZMA_RUN);
+            consumed = (size_t)slice - stream->avail_in;
+            made = (capacity - produced) - stream->avail_out;
+            memberEnded = status == LZMA_STREAM_END;
+            corrupt = status != LZMA_OK && status != LZMA_STREAM_END;
+            break;
+        }
+        case COMPRESSION_ZSTD: {
+            ZSTD_inBuffer in = {input + position, (size_t)slice, 0};
+            ZSTD_outBuffer outBuffer = {out + produced, capacity - produced, 0};
+            size_t status = ZSTD_decompressStream((ZSTD_DStream *)state, &outBuffer, &in);
+            consumed = in.pos;
+            made = outBuffer.pos;
+            corrupt = ZSTD_isError(status) != 0;
+            memberEnded = !corrupt && status == 0;  // a frame is complete and flushed
+            break;
+        }
+        default:
+            corrupt = true;
+            break;
+        }
+
+        position += consumed;
+        produced += made;
+        memberOutput = memberOutput || made > 0;
+        if (corrupt) {
+            // Junk after the last member, such as tape padding, isn't an error
+            end = true;
+            error = memberOutput || members == 0;
+            break;
+        }
+        if (memberEnded) {
+            members++;
+            boundary = true;
+            break;
+        }
+        if (consumed == 0 && made == 0) {
+            end = true;  // needs input that isn't there: truncated
+            break;
+        }
+    }
+    return produced;
+}
+
+bool CompressedText::open(const char *data, uint64_t size, Compression format) {
+    input = data;
+    inputSize = size;
+    this->format = format;
+    window.clear();
+    window.reserve(WINDOW_BYTES);  // never reallocated, so the index can point into it
+    windowOffset = 0;
+    windowLine = 0;
+    windowNewlines = 0;
+    index.reset(window.data(), 0);
+    checkpoints.assign(1, Checkpoint{0, 0, 0, false, nullptr});
+    checkpointSpacing = CHECKPOINT_BYTES;
+    furthestLines = 0;
+    furthestInput = 0;
+    totalLines = 0;
+    midLine = false;
+    done = false;
+    return decoder.start(format, data, size, 0);
+}
+
+bool CompressedText::ready(uint64_t first, uint64_t count) {
+    if (first < windowLine) {
+        return false;
+    }
+    uint64_t last = first + std::min(count, UINT64_MAX - first);
+    if (decoder.ended() || last <= windowLine + windowNewlines) {
+        return true;
+    }
+    // A window full of the wanted lines can't take any more of them
+    if (window.size() + DECODE_STEP > WINDOW_BYTES && first <= windowLine + windowNewlines) {
+        std::vector<uint64_t> starts;
+        return index.resolve(first - windowLine, 1, starts) == 0 || starts[0] == 0;
+    }
+    return false;
+}
+
+void CompressedText::step(uint64_t first) {
+    if (first < windowLine) {
+        restore(first);
+        return;
+    }
+    if (decoder.ended()) {
+        return;
+    }
+    if (window.size() + DECODE_STEP > WINDOW_BYTES) {
+        slide(first);
+        if (window.size() + DECODE_STEP > WINDOW_BYTES) {
+            return;  // nothing could go: ready() says so
+        }
+    }
+
+    size_t before = window.size();
+    window.resize(before + DECODE_STEP);
+    size_t made = decoder.decode(window.data() + before, DECODE_STEP);
+    window.resize(before + made);
+
+    uint64_t newlines;
+    findNthNewline(window.data() + before, window.data() + window.size(), UINT64_MAX, &newlines);
+    windowNewlines += newlines;
+    index.extend(window.data(), window.size());
+
+    if (made > 0) {
+        midLine = window.back() != '\n';
+    }
+    furthestLines = std::max(furthestLines, windowLine + windowNewlines);
+    furthestInput = std::max(furthestInput, decoder.inputOffset());
+    if (decoder.ended()) {
+        if (!done) {
+            // Whatever follows the last newline is one more, unterminated, line
+            done = true;
+            totalLines = windowLine + windowNewlines + (midLine ? 1 : 0);
+        }
+    } else if (windowOffset + window.size() >= checkpoints.back().offset + checkpointSpacing) {
+        addCheckpoint();
+    }
+}
+
+uint64_t CompressedText::lines(uint64_t first, uint64_t count, std::vector<std::string_view> &out) {
+    out.clear();
+    if (first < windowLine) {
+        return 0;
+    }
+    std::vector<uint64_t> starts;
+    uint64_t shown = index.resolve(first - windowLine, count, starts);
+    for (uint64_t i = 0; i < shown; i++) {
+        out.push_back(index.text(starts[i], starts[i + 1]));
+    }
+    return shown;
+}
+
+int CompressedText::progress() const {
+    return (int)(inputSize ? std::max(furthestInput, decoder.inputOffset()) * 100 / inputSize : 100);
+}
+
+// Start decoding again at the last checkpoint before line first
+void CompressedText::restore(uint64_t first) {
+    size_t i = checkpoints.size() - 1;
+    while (i > 0 && checkpoints[i].line >= first) {
+        i--;
+    }
+    if (checkpoints[i].state && !decoder.copyFrom(*checkpoints[i].state)) {
+        i = 0;  // out of memory for the copy; the start always works
+    }
+    const Checkpoint &checkpoint = checkpoints[i];
+    if (!checkpoint.state) {
+        decoder.start(format, input, inputSize, checkpoint.inputOffset);
+    }
+    midLine = checkpoint.midLine;
+    window.clear();
+    windowOffset = checkpoint.offset;
+    windowLine = checkpoint.line;
+    windowNewlines = 0;
+    index.reset(window.data(), 0);
+}
+
+// Make room at the end of a full window, keeping line first and what
+// follows where possible; the rest of the front goes up to a line boundary
+void CompressedText::slide(uint64_t first) {
+    size_t keepFrom = window.size() / 2;
+    if (first <= windowLine + windowNewlines) {
+        std::vector<uint64_t> starts;
+        if (index.resolve(first - windowLine, 1, starts) > 0) {
+            keepFrom = std::min(keepFrom, (size_t)starts[0]);
+        }
+    }
+    size_t lineStart = keepFrom;
+    while (lineStart > 0 && window[lineStart - 1] != '\n') {
+        lineStart--;
+    }
+    if (lineStart > 0) {
+        keepFrom = lineStart;
+    }
+    if (keepFrom == 0) {
+        return;
+    }
+
+    uint64_t dropped;
+    findNthNewline(window.data(), window.data() + keepFrom, UINT64_MAX, &dropped);
+    memmove(window.data(), window.data() + keepFrom, window.size() - keepFrom);
+    window.resize(window.size() - keepFrom);
+    windowOffset += keepFrom;
+    windowLine += dropped;
+    windowNewlines -= dropped;
+    index.reset(window.data(), window.size());
+}
+
+// Remember where the decoder is, if it can be resumed from here, thinning
+// out the checkpoints when there are too many
+void CompressedText::addCheckpoint() {
+    Checkpoint checkpoint{windowOffset + window.size(), windowLine + windowNewlines, decoder.inputOffset(), midLine,
+                          nullptr};
+    if (!decoder.atBoundary()) {
+        checkpoint.state = std::make_shared<StreamDecoder>();
+        if (!checkpoint.state->copyFrom(decoder)) {
+            return;  // only at the next member or frame
+        }
+    }
+    checkpoints.push_back(std::move(checkpoint));
+
+    if (checkpoints.size() > MAX_CHECKPOINTS) {
+        size_t kept = 0;
+        for (size_t i = 0; i < checkpoints.size(); i += 2) {
+            checkpoints[kept++] = std::move(checkpoints[i]);
+        }
+        checkpoints.resize(kept);
+        checkpointSpacing *= 2;
+    }
+}
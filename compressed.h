@@ -0,0 +1,138 @@
+#ifndef COMPRESSED_H_INCLUDED
+#define COMPRESSED_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "viewer.h"
+
+enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_XZ,
+    COMPRESSION_ZSTD
+};
+
+// Format of a buffer, told from its first bytes
+Compression detectCompression(const char *data, uint64_t size);
+
+// Name of a format, for the status line
+const char *compressionName(Compression format);
+
+// Streaming decoder over a compressed buffer held in memory, usually a
+// MappedFile. It can start at the beginning of any gzip member, xz stream or
+// zstd frame, and gzip decoders can also be copied mid-stream.
+class StreamDecoder {
+public:
+    StreamDecoder() = default;
+    ~StreamDecoder();
+    StreamDecoder(const StreamDecoder &) = delete;
+    StreamDecoder &operator=(const StreamDecoder &) = delete;
+
+    // Start decoding input at offset, which must be the start of a member or frame
+    bool start(Compression format, const char *input, uint64_t inputSize, uint64_t offset);
+
+    // Become a copy of other, to resume from where it is now. Only gzip
+    // decoders keep little enough state for this; false for the others.
+    bool copyFrom(const StreamDecoder &other);
+
+    // Decode up to capacity bytes; returns how many were produced. Stops
+    // early at the end of a member or frame.
+    size_t decode(char *out, size_t capacity);
+
+    // True once all of the input has been decoded, or it turned out corrupt
+    bool ended() const { return end; }
+    bool failed() const { return error; }
+
+    // True between two members or frames, where start() could pick up
+    bool atBoundary() const { return boundary; }
+
+    // How much of the input has been consumed
+    uint64_t inputOffset() const { return position; }
+
+private:
+    void release();
+    bool beginMember();
+
+    Compression format = COMPRESSION_NONE;
+    const char *input = nullptr;
+    uint64_t inputSize = 0;
+    uint64_t position = 0;
+    void *state = nullptr;  // z_stream, lzma_stream or ZSTD_DStream
+    bool boundary = false;
+    uint64_t members = 0;       // members or frames decoded to the end
+    bool memberOutput = false;  // whether the current member produced anything yet
+    bool end = true;
+    bool error = false;
+};
+
+// Decompressed text of a compressed buffer, seen through a window of at most
+// WINDOW_BYTES. Moving forwards decodes on and slides the window; moving back
+// before the window restarts decoding at the nearest checkpoint, which for
+// gzip is a copy of the decoder taken every so often and otherwise the start
+// of a member or frame. There are at most MAX_CHECKPOINTS, spread further
+// apart as the file turns out bigger, so memory use doesn't depend on how big
+// the decompressed text is.
+class CompressedText {
+public:
+    static const size_t WINDOW_BYTES = 16u << 20;
+    static const size_t MAX_CHECKPOINTS = 256;
+
+    bool open(const char *data, uint64_t size, Compression format);
+
+    // True once lines [first, first + count) are in the window, or as many of
+    // them as there are, or as many as fit
+    bool ready(uint64_t first, uint64_t count);
+
+    // Decode a step further towards being ready() for lines from first on
+    void step(uint64_t first);
+
+    // Lines [first, first + count) as far as they are in the window, without
+    // their line terminators; returns how many there are
+    uint64_t lines(uint64_t first, uint64_t count, std::vector<std::string_view> &out);
+
+    // True once the whole text has been decoded; knownLines() is the total then
+    bool complete() const { return done; }
+    uint64_t knownLines() const { return done ? totalLines : furthestLines; }
+    bool failed() const { return decoder.failed(); }
+
+    // How far into the compressed input decoding has got, in percent
+    int progress() const;
+
+private:
+    struct Checkpoint {
+        uint64_t offset;       // in the decompressed text
+        uint64_t line;         // newlines before offset
+        uint64_t inputOffset;  // where to start() again, when there is no state
+        bool midLine;          // whether offset is in the middle of a line
+        std::shared_ptr<StreamDecoder> state;
+    };
+
+    void restore(uint64_t first);
+    void slide(uint64_t first);
+    void addCheckpoint();
+
+    const char *input = nullptr;
+    uint64_t inputSize = 0;
+    Compression format = COMPRESSION_NONE;
+    StreamDecoder decoder;
+
+    std::vector<char> window;    // decompressed text from windowOffset; capacity WINDOW_BYTES
+    uint64_t windowOffset = 0;
+    uint64_t windowLine = 0;     // newlines before windowOffset
+    uint64_t windowNewlines = 0;
+    bool midLine = false;        // the text decoded so far doesn't end with a newline
+    LineIndex index;             // over the window
+
+    std::vector<Checkpoint> checkpoints;
+    uint64_t checkpointSpacing = 0;
+    uint64_t furthestLines = 0;  // newlines seen up to the furthest point decoded
+    uint64_t furthestInput = 0;
+    uint64_t totalLines = 0;
+    bool done = false;
+};
+
+#endif // COMPRESSED_H_INCLUDED
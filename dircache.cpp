@@ -0,0 +1,54 @@
+#include "dircache.h"
+
+void DirCache::put(DirListing &&listing, int choice, int topRow) {
+    auto found = byPath.find(listing.path);
+    if (found != byPath.end()) {
+        usedBytes -= found->second->bytes;
+        entries.erase(found->second);
+        byPath.erase(found);
+    }
+    if (!listing.readable) {
+        return;  // nothing worth keeping
+    }
+
+#ifndef _WIN32
+    listing.dir.reset();  // don't hold a descriptor per cached directory
+#endif
+    size_t bytes = listingBytes(listing);
+    std::string path = listing.path;
+    entries.push_front({std::move(listing), choice, topRow, bytes});
+    byPath[path] = entries.begin();
+    usedBytes += bytes;
+    evict();
+}
+
+bool DirCache::take(const std::string &path, DirListing &listing, int &choice, int &topRow) {
+    auto found = byPath.find(path);
+    if (found == byPath.end()) {
+        return false;
+    }
+
+    Cached &cached = *found->second;
+    int64_t mtime, ctime;
+    bool current = readDirectoryStamp(path, mtime, ctime) &&
+                   mtime == cached.listing.dirMtime && ctime == cached.listing.dirCtime;
+    if (current) {
+        listing = std::move(cached.listing);
+        choice = cached.choice;
+        topRow = cached.topRow;
+    }
+
+    usedBytes -= cached.bytes;
+    entries.erase(found->second);
+    byPath.erase(found);
+    return current;
+}
+
+// Drop least recently used listings until the cache fits its budget
+void DirCache::evict() {
+    while (usedBytes > maxBytes && !entries.empty()) {
+        usedBytes -= entries.back().bytes;
+        byPath.erase(entries.back().listing.path);
+        entries.pop_back();
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef DIRCACHE_H_INCLUDED
+#define DIRCACHE_H_INCLUDED
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "listing.h"
+
+// Default memory budget for cached listings
+const size_t DIR_CACHE_BYTES = 64u << 20;
+
+// Most recently used complete listings, keyed by path. A cached listing is
+// only handed out again while the directory's mtime and ctime are unchanged,
+// so entries added, removed or renamed since it was read force a rescan.
+// Sizes and times of the files inside are as of when it was read.
+class DirCache {
+public:
+    explicit DirCache(size_t maxBytes = DIR_CACHE_BYTES) : maxBytes(maxBytes) {}
+
+    // Store a complete listing along with where the view was when it was left
+    void put(DirListing &&listing, int choice, int topRow);
+
+    // Take the listing for path out of the cache if it is still current
+    bool take(const std::string &path, DirListing &listing, int &choice, int &topRow);
+
+    // True if a listing of path is cached, current or not
+    bool contains(const std::string &path) const { return byPath.count(path) != 0; }
+
+private:
+    struct Cached {
+        DirListing listing;
+        int choice;
+        int topRow;
+        size_t bytes;
+    };
+
+    void evict();
+
+    size_t maxBytes;
+    size_t usedBytes = 0;
+    std::list<Cached> entries;  // most recently used first
+    std::unordered_map<std::string, std::list<Cached>::iterator> byPath;
+};
+
+#endif // DIRCACHE_H_INCLUDED
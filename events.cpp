@@ -0,0 +1,107 @@
+#include "events.h"
+
+#include <atomic>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Set from wakeUi() until the UI has seen the wakeup, so a burst of them
+// costs one write
+static std::atomic<bool> wakePending{false};
+
+#ifdef _WIN32
+static HANDLE wakeEvent() {
+    static HANDLE event = CreateEvent(NULL, FALSE, FALSE, NULL);  // auto-reset
+    return event;
+}
+
+void wakeUi() {
+    if (!wakePending.exchange(true)) {
+        SetEvent(wakeEvent());
+    }
+}
+
+int waitForEvents(int timeoutMs, int watchFd) {
+    (void)watchFd;  // the Windows watcher calls wakeUi() from its own thread
+    HANDLE handles[2] = {GetStdHandle(STD_INPUT_HANDLE), wakeEvent()};
+    DWORD result = WaitForMultipleObjects(2, handles, FALSE, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+    if (result == WAIT_OBJECT_0) {
+        return EVENT_INPUT;
+    }
+    if (result == WAIT_OBJECT_0 + 1) {
+        wakePending = false;
+        return EVENT_WAKE;
+    }
+    return 0;
+}
+
+bool waitForInput(int timeoutMs) {
+    return WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs) ==
+           WAIT_OBJECT_0;
+}
+#else
+// Self-pipe: wakeUi() writes a byte, which makes the read end readable
+static int wakePipe[2] = {-1, -1};
+
+static bool openWakePipe() {
+    if (pipe(wakePipe) != 0) {
+        return false;
+    }
+    for (int fd : wakePipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+// Opened before main() runs, so no thread can start and wake the UI before it exists
+static const bool wakePipeOpen = openWakePipe();
+
+void wakeUi() {
+    // write() is async-signal-safe
+    if (wakePipeOpen && !wakePending.exchange(true)) {
+        int savedErrno = errno;
+        char byte = 0;
+        ssize_t written = write(wakePipe[1], &byte, 1);
+        (void)written;  // a full pipe wakes the reader just as well
+        errno = savedErrno;
+    }
+}
+
+int waitForEvents(int timeoutMs, int watchFd) {
+    struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {wakePipe[0], POLLIN, 0}, {watchFd, POLLIN, 0}};
+    int count = poll(fds, watchFd >= 0 ? 3 : 2, timeoutMs);
+    if (count < 0) {
+        return errno == EINTR ? EVENT_INPUT : 0;  // SIGWINCH, most likely: let getch() say
+    }
+
+    int events = 0;
+    if (fds[0].revents) {
+        events |= EVENT_INPUT;
+    }
+    if (fds[1].revents) {
+        // Clear the flag before the caller looks at the results, so nothing posted after is missed
+        char buffer[64];
+        while (read(wakePipe[0], buffer, sizeof(buffer)) > 0) {
+        }
+        wakePending = false;
+        events |= EVENT_WAKE;
+    }
+    if (watchFd >= 0 && fds[2].revents) {
+        events |= EVENT_WATCH;
+    }
+    return events;
+}
+
+bool waitForInput(int timeoutMs) {
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    int count = poll(&input, 1, timeoutMs);
+    return count > 0 || (count < 0 && errno == EINTR);
+}
+#endif
@@ -0,0 +1,25 @@
+#ifndef EVENTS_H_INCLUDED
+#define EVENTS_H_INCLUDED
+
+// What waitForEvents() woke up for
+enum {
+    EVENT_INPUT = 1,  // the terminal has input
+    EVENT_WAKE = 2,   // wakeUi() was called
+    EVENT_WATCH = 4   // the watch descriptor is readable
+};
+
+// Wake the UI thread out of waitForEvents(). Safe to call from any thread
+// and, on Unix-like systems, from a signal handler; calls made before the UI
+// gets round to looking are folded into one.
+void wakeUi();
+
+// Wait until there is terminal input, wakeUi() has been called or watchFd
+// (-1 for none) is readable, for at most timeoutMs (-1 for no limit). Returns
+// the EVENT_ flags for whatever happened, 0 on timeout. A terminal resize
+// interrupts the wait and counts as input, since it comes as KEY_RESIZE.
+int waitForEvents(int timeoutMs, int watchFd);
+
+// Wait for terminal input only, for at most timeoutMs; true if there is some
+bool waitForInput(int timeoutMs);
+
+#endif // EVENTS_H_INCLUDED
@@ -0,0 +1,690 @@
+#include "fileops.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "events.h"
+#include "listing.h"
+#include "walker.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+#endif
+
+// Most bytes moved by one system call, so cancelling doesn't wait for a whole big file
+static const size_t COPY_CHUNK_BYTES = 8u << 20;
+
+// Buffer for copies that go through user space
+static const size_t COPY_BUFFER_BYTES = 1u << 20;
+
+// Most files worked on at once; past this the disk is the limit, not round trips
+static const unsigned MAX_FILE_OP_THREADS = 8;
+
+// One file, link or directory of the trees being worked on
+struct FileOpItem {
+    std::string source;
+    std::string target;  // empty for deletes
+    uint8_t type;        // EntryType
+    uint32_t mode;
+    int64_t size;
+    int depth;           // 0 for the entries that were passed to start()
+    uint32_t root;
+};
+
+struct FileOpJob {
+    FileOpKind kind;
+    std::string dirPath;
+    std::vector<std::string> names;
+    std::string target;
+    std::chrono::steady_clock::time_point started;
+
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> planning{true};
+    std::atomic<bool> finished{false};
+    std::atomic<uint64_t> filesDone{0};
+    std::atomic<uint64_t> filesTotal{0};
+    std::atomic<uint64_t> bytesDone{0};
+    std::atomic<uint64_t> bytesTotal{0};
+    std::atomic<uint64_t> errors{0};
+
+    std::mutex mutex;  // protects everything below
+    std::string firstError;
+    std::vector<bool> rootFailed;  // something in this tree went wrong
+};
+
+const char *fileOpVerb(FileOpKind kind) {
+    switch (kind) {
+    case FILE_OP_MOVE:
+        return "moving";
+    case FILE_OP_DELETE:
+        return "deleting";
+    default:
+        return "copying";
+    }
+}
+
+static void fail(FileOpJob &job, uint32_t root, const std::string &message) {
+    job.errors++;
+    std::lock_guard<std::mutex> lock(job.mutex);
+    if (job.firstError.empty()) {
+        job.firstError = message;
+    }
+    if (root < job.rootFailed.size()) {
+        job.rootFailed[root] = true;
+    }
+}
+
+static std::string baseName(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+#ifdef _WIN32
+// Windows: the system reports errors through GetLastError() and copies whole
+// files itself, keeping their times and attributes
+
+static std::string systemError(const std::string &path) {
+    char text[256] = "";
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(), 0, text,
+                   sizeof(text), NULL);
+    std::string message = path + ": " + text;
+    while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) {
+        message.pop_back();
+    }
+    return message;
+}
+
+static bool isDirectory(const std::string &path) {
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+// Type, permissions and size of path itself; false if it doesn't exist
+static bool lookUp(const std::string &path, uint8_t &type, uint32_t &mode, int64_t &size) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    bool isDir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    type = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? ENTRY_LINK : isDir ? ENTRY_DIR : ENTRY_FILE;
+    mode = 0;
+    size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    return true;
+}
+
+static bool makeDirectory(const FileOpItem &item, std::string &error) {
+    if (!CreateDirectoryA(item.target.c_str(), NULL)) {
+        error = systemError(item.target);
+        return false;
+    }
+    return true;
+}
+
+static bool restoreDirectoryMode(const FileOpItem &, std::string &) {
+    return true;  // makeDirectory() left the attributes alone
+}
+
+static bool copyLink(const FileOpItem &item, std::string &error) {
+    error = item.source + ": links and junctions aren't copied";
+    return false;
+}
+
+struct CopyProgress {
+    FileOpJob *job;
+    uint64_t reported;
+};
+
+static DWORD CALLBACK reportCopyProgress(LARGE_INTEGER, LARGE_INTEGER transferred, LARGE_INTEGER, LARGE_INTEGER,
+                                         DWORD, DWORD, HANDLE, HANDLE, LPVOID data) {
+    CopyProgress *progress = (CopyProgress *)data;
+    progress->job->bytesDone += (uint64_t)transferred.QuadPart - progress->reported;
+    progress->reported = (uint64_t)transferred.QuadPart;
+    return progress->job->cancelled ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+}
+
+static bool copyRegularFile(FileOpJob &job, const FileOpItem &item, std::string &error) {
+    // CopyFileEx() goes through the copy engine, which offloads to the server on SMB shares and removes
+    // the target again when cancelled
+    CopyProgress progress = {&job, 0};
+    if (!CopyFileExA(item.source.c_str(), item.target.c_str(), reportCopyProgress, &progress, NULL,
+                     COPY_FILE_FAIL_IF_EXISTS)) {
+        if (!job.cancelled) {
+            error = systemError(item.source);
+        }
+        return false;
+    }
+    return true;
+}
+
+static bool removeEntry(const std::string &path, std::string &error) {
+    // Directory links and junctions are removed as directories, without touching what they point to
+    bool removed = isDirectory(path) ? RemoveDirectoryA(path.c_str()) : DeleteFileA(path.c_str());
+    if (!removed) {
+        error = systemError(path);
+    }
+    return removed;
+}
+
+static bool renameEntry(const std::string &source, const std::string &target, bool &crossDevice,
+                        std::string &error) {
+    if (MoveFileExA(source.c_str(), target.c_str(), 0)) {
+        return true;
+    }
+    crossDevice = GetLastError() == ERROR_NOT_SAME_DEVICE;
+    error = systemError(source);
+    return false;
+}
+#else
+// Unix-like systems
+
+static std::string systemError(const std::string &path) {
+    return path + ": " + strerror(errno);
+}
+
+static bool isDirectory(const std::string &path) {
+    struct stat fileStat;
+    return stat(path.c_str(), &fileStat) == 0 && S_ISDIR(fileStat.st_mode);
+}
+
+// Type, permissions and size of path itself, not what it links to; false if it doesn't exist
+static bool lookUp(const std::string &path, uint8_t &type, uint32_t &mode, int64_t &size) {
+    struct stat fileStat;
+    if (lstat(path.c_str(), &fileStat) != 0) {
+        return false;
+    }
+    type = typeFromMode(fileStat.st_mode);
+    mode = fileStat.st_mode;
+    size = fileStat.st_size;
+    return true;
+}
+
+static bool makeDirectory(const FileOpItem &item, std::string &error) {
+    // Writable by us whatever the source says, or its contents couldn't be copied in
+    if (mkdir(item.target.c_str(), (item.mode & 07777) | S_IRWXU) != 0) {
+        error = systemError(item.target);
+        return false;
+    }
+    return true;
+}
+
+// Give a directory made by makeDirectory() its source's permissions back,
+// once its contents are in
+static bool restoreDirectoryMode(const FileOpItem &item, std::string &error) {
+    if ((item.mode & S_IRWXU) != S_IRWXU && chmod(item.target.c_str(), item.mode & 07777) != 0) {
+        error = systemError(item.target);
+        return false;
+    }
+    return true;
+}
+
+static bool copyLink(const FileOpItem &item, std::string &error) {
+    std::vector<char> link(item.size > 0 ? (size_t)item.size + 1 : 4096);
+    ssize_t length = readlink(item.source.c_str(), link.data(), link.size());
+    if (length < 0 || (size_t)length >= link.size()) {
+        error = systemError(item.source);
+        return false;
+    }
+    link[length] = '\0';
+    if (symlink(link.data(), item.target.c_str()) != 0) {
+        error = systemError(item.target);
+        return false;
+    }
+    return true;
+}
+
+// Copy a chunk through a buffer; returns the number of bytes copied, 0 at
+// the end of the input or -1 with errno set
+static ssize_t readWrite(int in, int out, size_t chunk) {
+    static thread_local std::vector<char> buffer(COPY_BUFFER_BYTES);
+    ssize_t length = read(in, buffer.data(), std::min(chunk, buffer.size()));
+    for (ssize_t written = 0; written < length;) {
+        ssize_t count = write(out, buffer.data() + written, length - written);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += count;
+    }
+    return length;
+}
+
+// How copyContents() moves data, cheapest first
+enum CopyMethod {
+    COPY_BY_RANGE,     // in the kernel, and shared or server side where the file system can
+    COPY_BY_SENDFILE,  // in the kernel
+    COPY_BY_READ_WRITE
+};
+
+// Copy everything from in to out, from their current offsets on. Each way of
+// copying moves the offsets along, so the next one can take over midway when
+// a file system turns out not to support it.
+static bool copyContents(FileOpJob &job, int in, int out, int64_t size, std::string &error) {
+#ifdef __linux__
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0) {
+        job.bytesDone += (uint64_t)std::max<int64_t>(size, 0);  // a reflink: the data is shared, not copied
+        return true;
+    }
+#endif
+    CopyMethod method = COPY_BY_RANGE;
+#else
+    CopyMethod method = COPY_BY_READ_WRITE;
+#endif
+
+    uint64_t copied = 0;
+    while (!job.cancelled) {
+        ssize_t count;
+#ifdef __linux__
+        if (method == COPY_BY_RANGE) {
+            count = copy_file_range(in, NULL, out, NULL, COPY_CHUNK_BYTES, 0);
+        } else if (method == COPY_BY_SENDFILE) {
+            count = sendfile(out, in, NULL, COPY_CHUNK_BYTES);
+        } else
+#endif
+        {
+            count = readWrite(in, out, COPY_CHUNK_BYTES);
+        }
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bool unsupported = errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP ||
+                               errno == ENOTSUP;
+            if (!unsupported || method == COPY_BY_READ_WRITE) {
+                error = strerror(errno);
+                return false;
+            }
+            method = (CopyMethod)(method + 1);
+            continue;
+        }
+        if (count == 0) {
+            if (method == COPY_BY_RANGE && copied == 0 && size > 0) {
+                method = COPY_BY_READ_WRITE;  // pseudo-files read as empty through copy_file_range()
+                continue;
+            }
+            return true;
+        }
+        copied += count;
+        job.bytesDone += count;
+    }
+    return false;
+}
+
+static bool copyRegularFile(FileOpJob &job, const FileOpItem &item, std::string &error) {
+    int in = open(item.source.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (in < 0) {
+        error = systemError(item.source);
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(in, &fileStat) != 0) {
+        error = systemError(item.source);
+        close(in);
+        return false;
+    }
+    // O_EXCL: never overwrite, even something that turned up since planning
+    int out = open(item.target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (out < 0) {
+        error = systemError(item.target);
+        close(in);
+        return false;
+    }
+
+    std::string reason;
+    bool copied = copyContents(job, in, out, fileStat.st_size, reason);
+    if (copied) {
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+#ifdef __APPLE__
+        times[1] = fileStat.st_mtimespec;
+#else
+        times[1] = fileStat.st_mtim;
+#endif
+        fchmod(out, fileStat.st_mode & 07777);
+        futimens(out, times);
+    }
+    if (close(out) != 0 && copied) {
+        reason = strerror(errno);
+        copied = false;
+    }
+    close(in);
+    if (!copied) {
+        if (!job.cancelled) {
+            error = item.target + ": " + reason;
+        }
+        unlink(item.target.c_str());  // no half copies left behind
+    }
+    return copied;
+}
+
+static bool removeEntry(const std::string &path, std::string &error) {
+    struct stat fileStat;
+    bool isDir = lstat(path.c_str(), &fileStat) == 0 && S_ISDIR(fileStat.st_mode);
+    if ((isDir ? rmdir(path.c_str()) : unlink(path.c_str())) != 0) {
+        error = systemError(path);
+        return false;
+    }
+    return true;
+}
+
+static bool renameEntry(const std::string &source, const std::string &target, bool &crossDevice,
+                        std::string &error) {
+    if (rename(source.c_str(), target.c_str()) == 0) {
+        return true;
+    }
+    crossDevice = errno == EXDEV;
+    error = systemError(source);
+    return false;
+}
+#endif
+
+static unsigned fileOpThreads() {
+    return std::min(MAX_FILE_OP_THREADS, std::max(4u, std::thread::hardware_concurrency()));
+}
+
+// Call work(i) for every i in [0, count) from a few threads at once, until
+// done or cancelled
+static void runParallel(FileOpJob &job, size_t count, const std::function<void(size_t)> &work) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i; !job.cancelled && (i = next++) < count;) {
+            work(i);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min<size_t>(count, fileOpThreads()); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+}
+
+// Everything in the trees under roots, the roots included. Targets, if
+// given, are where each root goes; the items below it go to the same place
+// relative to that. Unless counted is false, everything is added to the
+// totals, and the sizes of the files too when they are to be copied.
+static std::vector<FileOpItem> planTrees(FileOpJob &job, const std::vector<std::string> &roots,
+                                         const std::vector<std::string> *targets, bool counted) {
+    std::vector<FileOpItem> items;
+    std::vector<std::string> walkRoots;
+    std::vector<uint32_t> walkRootIndex;
+    for (uint32_t i = 0; i < roots.size(); i++) {
+        FileOpItem item = {roots[i], targets ? (*targets)[i] : std::string(), ENTRY_UNKNOWN, 0, 0, 0, i};
+        if (!lookUp(item.source, item.type, item.mode, item.size)) {
+            fail(job, i, systemError(item.source));
+            continue;
+        }
+        if (item.type == ENTRY_DIR) {
+            walkRoots.push_back(item.source);  // a link to a directory is handled as the link
+            walkRootIndex.push_back(i);
+        }
+        if (counted) {
+            job.filesTotal++;
+            job.bytesTotal += targets && item.type == ENTRY_FILE ? (uint64_t)item.size : 0;
+        }
+        items.push_back(std::move(item));
+    }
+
+    std::mutex mutex;
+    WalkOptions options;
+    options.statEntries = true;
+    // A directory that can't be read leaves its tree incomplete, so it fails
+    // the root it is under; that keeps a move from deleting the source
+    options.onError = [&](const std::string &path, int error) {
+        for (size_t i = 0; i < walkRoots.size(); i++) {
+            const std::string &root = walkRoots[i];
+            if (path.compare(0, root.size(), root) == 0 && (path.size() == root.size() || path[root.size()] == '/')) {
+                fail(job, walkRootIndex[i], path + ": " + strerror(error));
+                break;
+            }
+        }
+    };
+    walkTrees(walkRoots, options, [&](const WalkEntry &found) {
+        uint32_t root = walkRootIndex[found.root];
+        FileOpItem item = {*found.dirPath + "/", std::string(), found.type, found.mode, found.size, found.depth, root};
+        item.source.append(found.name, found.nameLength);
+        if (targets) {
+            item.target = (*targets)[root] + item.source.substr(roots[root].size());
+        }
+        if (counted) {
+            job.filesTotal++;
+            job.bytesTotal += targets && item.type == ENTRY_FILE ? (uint64_t)item.size : 0;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(std::move(item));
+    }, job.cancelled);
+    return items;
+}
+
+// Delete the trees under roots, files first, many at a time, and then the
+// directories, deepest first. When counted is false the work was already
+// counted as part of a move.
+static void deleteTrees(FileOpJob &job, const std::vector<std::string> &roots, bool counted) {
+    std::vector<FileOpItem> items = planTrees(job, roots, nullptr, counted);
+    job.planning = false;
+
+    auto removeItem = [&](const FileOpItem &item) {
+        std::string error;
+        if (!removeEntry(item.source, error)) {
+            fail(job, item.root, error);
+        }
+        if (counted) {
+            job.filesDone++;
+        }
+    };
+    auto directoriesLast = std::stable_partition(items.begin(), items.end(), [](const FileOpItem &item) {
+        return item.type != ENTRY_DIR;
+    });
+    runParallel(job, directoriesLast - items.begin(), [&](size_t i) { removeItem(items[i]); });
+    std::stable_sort(directoriesLast, items.end(), [](const FileOpItem &a, const FileOpItem &b) {
+        return a.depth > b.depth;
+    });
+    for (auto it = directoriesLast; it != items.end() && !job.cancelled; ++it) {
+        removeItem(*it);
+    }
+}
+
+// Copy the trees under roots to targets: directories first, parents before
+// children, then everything else, many at a time, and last the permissions
+// of the directories, deepest first
+static void copyTrees(FileOpJob &job, const std::vector<std::string> &roots, const std::vector<std::string> &targets) {
+    std::vector<FileOpItem> items = planTrees(job, roots, &targets, true);
+    job.planning = false;
+
+    auto filesFirst = std::stable_partition(items.begin(), items.end(), [](const FileOpItem &item) {
+        return item.type == ENTRY_DIR;
+    });
+    std::stable_sort(items.begin(), filesFirst, [](const FileOpItem &a, const FileOpItem &b) {
+        return a.depth < b.depth;
+    });
+    std::vector<const FileOpItem *> made;
+    for (auto it = items.begin(); it != filesFirst && !job.cancelled; ++it) {
+        std::string error;
+        if (makeDirectory(*it, error)) {
+            made.push_back(&*it);
+        } else {
+            fail(job, it->root, error);
+        }
+        job.filesDone++;
+    }
+
+    size_t firstFile = filesFirst - items.begin();
+    runParallel(job, items.size() - firstFile, [&](size_t i) {
+        const FileOpItem &item = items[firstFile + i];
+        std::string error;
+        bool copied = false;
+        if (item.type == ENTRY_FILE) {
+            copied = copyRegularFile(job, item, error);
+        } else if (item.type == ENTRY_LINK) {
+            copied = copyLink(item, error);
+        } else {
+            error = item.source + ": not a regular file, not copied";
+        }
+        if (!copied && !job.cancelled) {
+            fail(job, item.root, error);
+        }
+        if (copied || !job.cancelled) {
+            job.filesDone++;  // else it is left undone
+        }
+    });
+
+    // Also after a cancel, so what was copied so far has the right permissions
+    for (auto it = made.rbegin(); it != made.rend(); ++it) {
+        std::string error;
+        if (!restoreDirectoryMode(**it, error)) {
+            fail(job, (*it)->root, error);
+        }
+    }
+}
+
+// Work out where each of roots goes, leaving out those that can't go there
+static void resolveTargets(FileOpJob &job, std::vector<std::string> &roots, std::vector<std::string> &targets) {
+    bool intoDirectory = isDirectory(job.target);
+    if (!intoDirectory && roots.size() > 1) {
+        fail(job, (uint32_t)-1, "Not a directory: " + job.target);
+        roots.clear();
+        return;
+    }
+
+    std::vector<std::string> kept;
+    for (size_t i = 0; i < roots.size(); i++) {
+        std::string target = intoDirectory ? job.target + "/" + baseName(roots[i]) : job.target;
+        uint8_t type;
+        uint32_t mode;
+        int64_t size;
+        if (lookUp(target, type, mode, size)) {
+            fail(job, (uint32_t)i, "Already exists: " + target);
+        } else if (target.compare(0, roots[i].size() + 1, roots[i] + "/") == 0) {
+            fail(job, (uint32_t)i, "Can't put a directory inside itself: " + roots[i]);
+        } else {
+            kept.push_back(roots[i]);
+            targets.push_back(target);
+        }
+    }
+    roots.swap(kept);
+}
+
+static void runFileOperation(std::shared_ptr<FileOpJob> job) {
+    std::vector<std::string> roots;
+    for (const std::string &name : job->names) {
+        roots.push_back(job->dirPath + "/" + name);
+    }
+
+    if (job->kind == FILE_OP_DELETE) {
+        job->rootFailed.assign(roots.size(), false);
+        deleteTrees(*job, roots, true);
+    } else {
+        std::vector<std::string> targets;
+        resolveTargets(*job, roots, targets);
+
+        if (job->kind == FILE_OP_MOVE) {
+            // Renaming is all it takes within a file system; the rest is copied and then deleted
+            std::vector<std::string> copyRoots, copyTargets;
+            for (size_t i = 0; i < roots.size() && !job->cancelled; i++) {
+                bool crossDevice = false;
+                std::string error;
+                job->filesTotal++;
+                if (renameEntry(roots[i], targets[i], crossDevice, error)) {
+                    job->filesDone++;
+                } else if (crossDevice) {
+                    job->filesTotal--;
+                    copyRoots.push_back(roots[i]);
+                    copyTargets.push_back(targets[i]);
+                } else {
+                    fail(*job, (uint32_t)-1, error);
+                }
+            }
+            roots.swap(copyRoots);
+            targets.swap(copyTargets);
+        }
+
+        job->rootFailed.assign(roots.size(), false);
+        copyTrees(*job, roots, targets);
+
+        if (job->kind == FILE_OP_MOVE && !job->cancelled) {
+            std::vector<std::string> copied;
+            for (size_t i = 0; i < roots.size(); i++) {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                if (!job->rootFailed[i]) {
+                    copied.push_back(roots[i]);  // the sources of trees that didn't copy completely stay
+                }
+            }
+            deleteTrees(*job, copied, false);
+        }
+    }
+
+    job->planning = false;
+    job->finished = true;
+    wakeUi();
+}
+
+FileOperation::~FileOperation() {
+    cancel();
+}
+
+void FileOperation::start(FileOpKind kind, const std::string &dirPath, const std::vector<std::string> &names,
+                          const std::string &target) {
+    cancel();
+    job = std::make_shared<FileOpJob>();
+    job->kind = kind;
+    job->dirPath = dirPath;
+    job->names = names;
+    job->target = target;
+    while (job->target.size() > 1 && job->target.back() == '/') {
+        job->target.pop_back();
+    }
+    job->started = std::chrono::steady_clock::now();
+    std::thread(runFileOperation, job).detach();
+}
+
+void FileOperation::cancel() {
+    if (job) {
+        job->cancelled = true;
+    }
+}
+
+bool FileOperation::finished() const {
+    return job && job->finished;
+}
+
+FileOpProgress FileOperation::progress() const {
+    FileOpProgress progress;
+    if (!job) {
+        return progress;
+    }
+    progress.kind = job->kind;
+    progress.planning = job->planning;
+    progress.filesDone = job->filesDone;
+    progress.filesTotal = job->filesTotal;
+    progress.bytesDone = job->bytesDone;
+    progress.bytesTotal = job->bytesTotal;
+    progress.errors = job->errors;
+    progress.cancelled = job->cancelled;
+    progress.stopped = progress.cancelled && progress.filesDone < progress.filesTotal;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->started).count();
+    progress.bytesPerSecond = seconds > 0 ? progress.bytesDone / seconds : 0;
+    std::lock_guard<std::mutex> lock(job->mutex);
+    progress.firstError = job->firstError;
+    return progress;
+}
@@ -0,0 +1,76 @@
+#ifndef FILEOPS_H_INCLUDED
+#define FILEOPS_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum FileOpKind {
+    FILE_OP_COPY,
+    FILE_OP_MOVE,
+    FILE_OP_DELETE
+};
+
+// Name of an operation as a verb, for the status line ("copying", "moving", ...)
+const char *fileOpVerb(FileOpKind kind);
+
+// How far an operation has got. Totals grow while planning is set, as the
+// trees are walked; after that only the done counts move.
+struct FileOpProgress {
+    FileOpKind kind = FILE_OP_COPY;
+    bool planning = true;
+    uint64_t filesDone = 0;   // files, links and directories
+    uint64_t filesTotal = 0;
+    uint64_t bytesDone = 0;
+    uint64_t bytesTotal = 0;
+    double bytesPerSecond = 0;
+    uint64_t errors = 0;
+    std::string firstError;
+    bool cancelled = false;  // cancel() has been called
+    bool stopped = false;    // ...and some of the work was left undone
+};
+
+struct FileOpJob;
+
+// Copy, move or delete some entries of a directory, with their trees, on a
+// background thread. The trees are walked with walkTrees() first, then files
+// are handled by several worker threads at once, which pays with lots of
+// small files. Nothing that exists already is overwritten: such entries are
+// skipped and counted as errors.
+//
+// Copies use a reflink where the file system can share the data, then
+// copy_file_range() or sendfile(), which keep the data in the kernel, and
+// plain read()/write() when neither works; CopyFileEx() on Windows. Moves are
+// a rename() when source and target are on the same file system, and a copy
+// followed by deleting the sources otherwise, only for trees that copied
+// without errors.
+class FileOperation {
+public:
+    ~FileOperation();
+
+    // Start on dirPath/name for each of names. For copies and moves into an
+    // existing directory each entry keeps its name there; a single entry may
+    // also be given the target as its new name.
+    void start(FileOpKind kind, const std::string &dirPath, const std::vector<std::string> &names,
+               const std::string &target);
+
+    // Stop at the next file; a file being copied is removed again
+    void cancel();
+
+    // True while an operation has been started and not yet collected by finished()
+    bool active() const { return job != nullptr; }
+
+    // True once the operation is over; the progress is final then
+    bool finished() const;
+
+    FileOpProgress progress() const;
+
+    // Forget the operation once its results have been used
+    void clear() { job.reset(); }
+
+private:
+    std::shared_ptr<FileOpJob> job;
+};
+
+#endif // FILEOPS_H_INCLUDED
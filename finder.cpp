@@ -0,0 +1,134 @@
+#include "finder.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "events.h"
+#include "scan.h"
+#include "walker.h"
+
+// State shared between a DirFinder and the thread running the walk
+struct FindJob {
+    std::string root;
+    std::string pattern;  // lowercase
+    std::shared_ptr<const TreeIndex> index;
+    std::atomic<bool> cancelled{false};
+    std::atomic<size_t> scanned{0};
+
+    std::mutex mutex;  // protects everything below
+    std::condition_variable space;  // signalled when drain() empties the queue
+    std::string names;              // names of matches not drained yet
+    std::vector<DirEntry> entries;  // nameOffset is relative to names
+    bool finished = false;
+    bool drained = false;
+};
+
+static void findMatches(std::shared_ptr<FindJob> job) {
+    WalkOptions options;
+    options.maxDepth = FIND_MAX_DEPTH;
+    options.oneFileSystem = true;
+    options.index = job->index.get();
+
+    walkTrees({job->root}, options, [&](const WalkEntry &found) {
+        job->scanned.fetch_add(1, std::memory_order_relaxed);
+        if (!containsFolded(found.name, found.nameLength, found.nameLength, job->pattern)) {
+            return;
+        }
+
+        // Name relative to the root, and metadata, worked out before taking the lock.
+        // Paths below "/" start with "//", which is skipped the same way.
+        static thread_local PathBuffer buffer;
+        const std::string &path = buffer.join(*found.dirPath, std::string_view(found.name, found.nameLength));
+        DirEntry entry = {};
+        entry.type = found.type;
+        if (found.hasStat && found.type != ENTRY_LINK) {
+            // Already stat'ed by the walk, or taken from the index
+            entry.mode = found.mode;
+            entry.size = found.size;
+            entry.mtime = found.mtime;
+            entry.flags = ENTRY_HAS_STAT | ENTRY_STAT_OK;
+        } else {
+            statEntry(path.c_str(), entry);
+        }
+        std::string_view relative = std::string_view(path).substr(job->root.size() + 1);
+
+        std::unique_lock<std::mutex> lock(job->mutex);
+        while (job->entries.size() >= FIND_QUEUE_LIMIT && !job->cancelled) {
+            job->space.wait_for(lock, std::chrono::milliseconds(50));
+        }
+        entry.nameOffset = (uint32_t)job->names.size();
+        entry.nameLength = (uint16_t)relative.size();
+        job->names.append(relative.data(), relative.size());
+        job->names.push_back('\0');
+        job->entries.push_back(entry);
+        wakeUi();
+    }, job->cancelled);
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->finished = true;
+    wakeUi();
+}
+
+DirFinder::~DirFinder() {
+    cancel();
+}
+
+void DirFinder::start(const std::string &root, const std::string &pattern, std::shared_ptr<const TreeIndex> index) {
+    cancel();
+    job = std::make_shared<FindJob>();
+    job->root = root;
+    job->index = std::move(index);
+    for (char c : pattern) {
+        job->pattern.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    }
+    std::thread(findMatches, job).detach();
+}
+
+void DirFinder::cancel() {
+    if (job) {
+        job->cancelled = true;
+        job->space.notify_all();
+        job.reset();
+    }
+}
+
+bool DirFinder::drain(DirListing &listing) {
+    if (!job) {
+        return false;
+    }
+
+    std::string names;
+    std::vector<DirEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        names.swap(job->names);
+        entries.swap(job->entries);
+        job->drained = job->finished;
+        listing.readable = true;
+    }
+    job->space.notify_all();
+
+    uint32_t base = (uint32_t)listing.names.size();
+    listing.names += names;
+    for (DirEntry &entry : entries) {
+        entry.nameOffset += base;
+        listing.entries.push_back(entry);
+    }
+    return !entries.empty();
+}
+
+bool DirFinder::busy() const {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return !job->drained;
+}
+
+size_t DirFinder::scanned() const {
+    return job ? job->scanned.load() : 0;
+}
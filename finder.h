@@ -0,0 +1,49 @@
+#ifndef FINDER_H_INCLUDED
+#define FINDER_H_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "listing.h"
+#include "treeindex.h"
+
+// How deep below the starting directory a find looks
+const int FIND_MAX_DEPTH = 32;
+
+// Matches waiting for the UI beyond this many hold the walker threads up
+const size_t FIND_QUEUE_LIMIT = 4096;
+
+struct FindJob;
+
+// Finds entries whose names contain a pattern, ignoring case, anywhere below
+// a directory. The tree is walked with walkTrees() on a background thread,
+// without leaving the starting file system, and matches are handed over
+// through a bounded queue as they are found. Their names in the listing are
+// paths relative to the starting directory. Directories a TreeIndex has, and
+// that are unchanged, are taken from it instead of being read.
+class DirFinder {
+public:
+    ~DirFinder();
+
+    // Start looking below root, cancelling any earlier search
+    void start(const std::string &root, const std::string &pattern, std::shared_ptr<const TreeIndex> index);
+
+    // Stop the search; the walker threads exit at their next entry
+    void cancel();
+
+    // Move the matches found since the last call into listing. Returns true
+    // if there were any.
+    bool drain(DirListing &listing);
+
+    // True until the search has finished or been cancelled, and been fully drained
+    bool busy() const;
+
+    // Number of entries looked at so far
+    size_t scanned() const;
+
+private:
+    std::shared_ptr<FindJob> job;
+};
+
+#endif // FINDER_H_INCLUDED
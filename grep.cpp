@@ -0,0 +1,360 @@
+#include "grep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <regex>
+#include <thread>
+
+#include "finder.h"
+#include "events.h"
+#include "scan.h"
+#include "viewer.h"
+#include "walker.h"
+
+// Longest part of a line kept for display
+static const size_t GREP_TEXT_BYTES = 256;
+
+// Longest piece of a line handed to std::regex at once. libstdc++ matches
+// recursively, a stack frame or more per character, so a whole minified
+// script or JSON file on one line would overflow a walker thread's stack.
+static const size_t GREP_REGEX_BYTES = 4096;
+
+// Hits waiting for the UI beyond this many hold the walker threads up
+static const size_t GREP_QUEUE_LIMIT = 4096;
+
+// State shared between a FileGrep and the thread running the walk
+struct GrepJob {
+    std::string root;
+    bool useRegex = false;
+    std::regex regex;
+    std::string literal;  // in every match; the whole pattern unless useRegex
+    std::atomic<bool> cancelled{false};
+    std::atomic<size_t> searched{0};
+    std::atomic<size_t> found{0};
+
+    std::mutex mutex;  // protects everything below
+    std::condition_variable space;  // signalled when drain() empties the queue
+    std::string names;              // names of hits not drained yet
+    std::vector<DirEntry> entries;  // nameOffset is relative to names
+    std::vector<GrepHit> hits;
+    bool finished = false;
+    bool drained = false;
+    bool truncated = false;
+};
+
+// Longest run of plain characters that every match of an ECMAScript pattern
+// must contain, or "" if that can't be told simply. Anything inside groups or
+// classes, or made optional by a quantifier, is left out.
+static std::string requiredLiteral(const std::string &pattern) {
+    if (pattern.find('|') != std::string::npos) {
+        return "";
+    }
+    std::string best, run;
+    int depth = 0;
+    bool inClass = false;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        char next = i + 1 < pattern.size() ? pattern[i + 1] : '\0';
+        if (inClass) {
+            if (c == '\\') {
+                i++;
+            } else if (c == ']') {
+                inClass = false;
+            }
+            continue;
+        }
+        bool plain = depth == 0 && !strchr("\\^$.*+?()[]{}|", c);
+        if (plain && next != '*' && next != '?' && next != '{') {
+            run.push_back(c);
+            continue;
+        }
+        if (run.size() > best.size()) {
+            best = run;
+        }
+        run.clear();
+        if (c == '\\') {
+            i++;  // \d, \., ...: not worth telling apart
+        } else if (c == '[') {
+            inClass = true;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth--;
+        }
+    }
+    return run.size() > best.size() ? run : best;
+}
+
+// Append one hit for path to the lists, with the line made printable
+static void addHit(std::string &names, std::vector<DirEntry> &entries, std::vector<GrepHit> &hits,
+                   std::string_view path, uint64_t line, const char *begin, const char *end) {
+    DirEntry entry = {};
+    entry.nameOffset = (uint32_t)names.size();
+    entry.type = ENTRY_FILE;
+    entry.flags = ENTRY_HAS_STAT;
+
+    size_t start = names.size();
+    names.append(path.data(), path.size());
+    names += ":" + std::to_string(line + 1) + ": ";
+    end = std::min(end, begin + GREP_TEXT_BYTES);
+    for (const char *p = begin; p < end; p++) {
+        unsigned char c = *p;
+        names.push_back(c == '\t' ? ' ' : c < 32 || c == 127 ? '?' : (char)c);
+    }
+    entry.nameLength = (uint16_t)(names.size() - start);
+    names.push_back('\0');
+
+    entries.push_back(entry);
+    hits.push_back({line, (uint16_t)path.size()});
+}
+
+// Whether the regex matches within [begin, end), a piece of the line
+// [lineStart, lineEnd): ^ and $ only match at the ends of the line itself
+static bool regexSearchIn(const GrepJob &job, const char *lineStart, const char *lineEnd, const char *begin,
+                          const char *end) {
+    std::regex_constants::match_flag_type flags = std::regex_constants::match_default;
+    if (begin > lineStart) {
+        flags |= std::regex_constants::match_prev_avail;
+    }
+    if (end < lineEnd) {
+        flags |= std::regex_constants::match_not_eol;
+    }
+    return std::regex_search(begin, end, job.regex, flags);
+}
+
+// Whether the regex matches in a line. Lines longer than GREP_REGEX_BYTES are
+// searched a window at a time: around each occurrence of the literal, or
+// overlapping by half where there is none. On such lines a match reaching
+// more than a quarter of a window from the literal, or longer than half a
+// window where there is no literal, may be missed.
+static bool regexMatches(const GrepJob &job, const char *lineStart, const char *lineEnd) {
+    if ((size_t)(lineEnd - lineStart) <= GREP_REGEX_BYTES) {
+        return std::regex_search(lineStart, lineEnd, job.regex);
+    }
+    const size_t half = GREP_REGEX_BYTES / 2;
+    if (!job.literal.empty()) {
+        // Occurrences closer than a quarter window to the last one are in its window already
+        const char *hit = findSubstring(lineStart, lineEnd, job.literal);
+        while (hit && !job.cancelled) {
+            const char *begin = hit - std::min((size_t)(hit - lineStart), half);
+            const char *end = hit + std::min((size_t)(lineEnd - hit), half);
+            if (regexSearchIn(job, lineStart, lineEnd, begin, end)) {
+                return true;
+            }
+            const char *next = hit + std::min((size_t)(lineEnd - hit), GREP_REGEX_BYTES / 4);
+            hit = findSubstring(next, lineEnd, job.literal);
+        }
+        return false;
+    }
+    for (const char *begin = lineStart; !job.cancelled; begin += half) {
+        const char *end = begin + std::min((size_t)(lineEnd - begin), GREP_REGEX_BYTES);
+        if (regexSearchIn(job, lineStart, lineEnd, begin, end)) {
+            return true;
+        }
+        if (end == lineEnd) {
+            break;
+        }
+    }
+    return false;
+}
+
+// Search one file, appending what it finds to the lists
+static void grepFile(GrepJob &job, const std::string &path, std::string_view relative, std::string &names,
+                     std::vector<DirEntry> &entries, std::vector<GrepHit> &hits) {
+    MappedFile file;
+    if (!file.open(path) || file.size() == 0) {
+        return;
+    }
+    const char *data = file.data();
+    const char *end = data + file.size();
+    if (looksBinary(data, file.size())) {
+        return;
+    }
+
+    uint64_t line = 0;
+    const char *counted = data;  // newlines before this have been counted into line
+    const char *p = data;
+    size_t count = 0;
+    while (p < end && count < GREP_HITS_PER_FILE && !job.cancelled) {
+        // Next candidate line: one holding the literal, or simply the next line
+        const char *lineStart;
+        const char *lineEnd;
+        if (!job.literal.empty()) {
+            const char *hit = findSubstring(p, end, job.literal);
+            if (!hit) {
+                break;
+            }
+            lineStart = hit;
+            while (lineStart > p && lineStart[-1] != '\n') {
+                lineStart--;
+            }
+            lineEnd = (const char *)memchr(hit, '\n', end - hit);
+        } else {
+            lineStart = p;
+            lineEnd = (const char *)memchr(p, '\n', end - p);
+        }
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        p = lineEnd + 1;
+
+        bool match = !job.useRegex || regexMatches(job, lineStart, lineEnd);
+        if (match) {
+            uint64_t passed = 0;
+            findNthNewline(counted, lineStart, UINT64_MAX, &passed);
+            line += passed;
+            counted = lineStart;
+            const char *textEnd = lineEnd > lineStart && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd;
+            addHit(names, entries, hits, relative, line, lineStart, textEnd);
+            count++;
+        }
+    }
+}
+
+// Hand a file's hits over to the UI, waiting while the queue is full
+static void publishHits(GrepJob &job, const std::string &names, std::vector<DirEntry> &entries,
+                        const std::vector<GrepHit> &hits) {
+    std::unique_lock<std::mutex> lock(job.mutex);
+    while (job.entries.size() >= GREP_QUEUE_LIMIT && !job.cancelled) {
+        job.space.wait_for(lock, std::chrono::milliseconds(50));
+    }
+    uint32_t base = (uint32_t)job.names.size();
+    job.names += names;
+    for (DirEntry &entry : entries) {
+        entry.nameOffset += base;
+        job.entries.push_back(entry);
+    }
+    job.hits.insert(job.hits.end(), hits.begin(), hits.end());
+    wakeUi();
+}
+
+static void grepTree(std::shared_ptr<GrepJob> job) {
+    WalkOptions options;
+    options.maxDepth = FIND_MAX_DEPTH;
+    options.oneFileSystem = true;
+
+    walkTrees({job->root}, options, [&](const WalkEntry &found) {
+        if (found.type != ENTRY_FILE) {
+            return;
+        }
+        // Paths below "/" start with "//", which is skipped the same way
+        static thread_local PathBuffer buffer;
+        const std::string &path = buffer.join(*found.dirPath, std::string_view(found.name, found.nameLength));
+        std::string_view relative = std::string_view(path).substr(job->root.size() + 1);
+
+        // Kept from file to file, like the path, so most files cost no allocations
+        static thread_local std::string names;
+        static thread_local std::vector<DirEntry> entries;
+        static thread_local std::vector<GrepHit> hits;
+        names.clear();
+        entries.clear();
+        hits.clear();
+        grepFile(*job, path, relative, names, entries, hits);
+        job->searched.fetch_add(1, std::memory_order_relaxed);
+        if (hits.empty()) {
+            return;
+        }
+        publishHits(*job, names, entries, hits);
+        if (job->found.fetch_add(hits.size()) + hits.size() >= GREP_MAX_HITS) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->truncated = true;
+            job->cancelled = true;
+        }
+    }, job->cancelled);
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->finished = true;
+    wakeUi();
+}
+
+FileGrep::~FileGrep() {
+    cancel();
+}
+
+bool checkRegex(const std::string &pattern, std::string &error) {
+    try {
+        std::regex check(pattern, std::regex::ECMAScript);
+    } catch (const std::regex_error &e) {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+void FileGrep::start(const std::string &root, const std::string &pattern, bool regex) {
+    cancel();
+    job = std::make_shared<GrepJob>();
+    job->root = root;
+    job->useRegex = regex;
+    job->literal = pattern;
+    if (regex) {
+        try {
+            job->regex = std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+            job->literal = requiredLiteral(pattern);
+        } catch (const std::regex_error &) {
+            job->finished = true;  // nothing to look for
+            return;
+        }
+    }
+    std::thread(grepTree, job).detach();
+}
+
+void FileGrep::cancel() {
+    if (job) {
+        job->cancelled = true;
+        job->space.notify_all();
+        job.reset();
+    }
+}
+
+bool FileGrep::drain(DirListing &listing, std::vector<GrepHit> &hits) {
+    if (!job) {
+        return false;
+    }
+
+    std::string names;
+    std::vector<DirEntry> entries;
+    std::vector<GrepHit> newHits;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        names.swap(job->names);
+        entries.swap(job->entries);
+        newHits.swap(job->hits);
+        job->drained = job->finished;
+        listing.readable = true;
+    }
+    job->space.notify_all();
+
+    uint32_t base = (uint32_t)listing.names.size();
+    listing.names += names;
+    for (DirEntry &entry : entries) {
+        entry.nameOffset += base;
+        listing.entries.push_back(entry);
+    }
+    hits.insert(hits.end(), newHits.begin(), newHits.end());
+    return !entries.empty();
+}
+
+bool FileGrep::busy() const {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return !job->drained;
+}
+
+size_t FileGrep::searched() const {
+    return job ? job->searched.load() : 0;
+}
+
+bool FileGrep::truncated() const {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return job->truncated;
+}
@@ -0,0 +1,60 @@
+#ifndef GREP_H_INCLUDED
+#define GREP_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "listing.h"
+
+// Lines of a file reported at most, so one huge log can't drown the rest
+const size_t GREP_HITS_PER_FILE = 1000;
+
+// Lines reported at most in all; the search stops once it has found this many
+const size_t GREP_MAX_HITS = 100000;
+
+// Where a hit is: the listing entry's name is "path:line: text", and path is
+// the first pathLength bytes of it
+struct GrepHit {
+    uint64_t line;  // 0 based
+    uint16_t pathLength;
+};
+
+// False, with the reason in error, if pattern isn't a valid regular expression
+bool checkRegex(const std::string &pattern, std::string &error);
+
+struct GrepJob;
+
+// Searches the contents of every regular file below a directory for a
+// literal string or an ECMAScript regular expression. Files are walked and
+// read by the walkTrees() worker threads, memory mapped, one line per hit.
+class FileGrep {
+public:
+    ~FileGrep();
+
+    // Start searching below root, cancelling any earlier search. A regex
+    // pattern should have been checked with checkRegex(); one that doesn't
+    // compile matches nothing.
+    void start(const std::string &root, const std::string &pattern, bool regex);
+    void cancel();
+
+    // Move the hits found since the last call into listing and hits, which
+    // are kept parallel. Returns true if there were any.
+    bool drain(DirListing &listing, std::vector<GrepHit> &hits);
+
+    // True until the search has finished or been cancelled, and been fully drained
+    bool busy() const;
+
+    // Number of files searched so far
+    size_t searched() const;
+
+    // True if the search stopped at GREP_MAX_HITS
+    bool truncated() const;
+
+private:
+    std::shared_ptr<GrepJob> job;
+};
+
+#endif // GREP_H_INCLUDED
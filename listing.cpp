@@ -0,0 +1,275 @@
+#include "listing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+#define FIND_FIRST_EX_LARGE_FETCH 2  // Windows 7 and later
+#endif
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+uint8_t typeFromDirent(unsigned char dType) {
+    switch (dType) {
+    case DT_REG: return ENTRY_FILE;
+    case DT_DIR: return ENTRY_DIR;
+    case DT_LNK: return ENTRY_LINK;
+    case DT_UNKNOWN: return ENTRY_UNKNOWN;  // some network and older filesystems
+    default: return ENTRY_OTHER;
+    }
+}
+
+uint8_t typeFromMode(uint32_t mode) {
+    if (S_ISREG(mode)) return ENTRY_FILE;
+    if (S_ISDIR(mode)) return ENTRY_DIR;
+    if (S_ISLNK(mode)) return ENTRY_LINK;
+    return ENTRY_OTHER;
+}
+#endif
+
+#ifdef _WIN32
+// A FILETIME (100 ns units since 1601) as seconds since the Unix epoch
+static int64_t unixSeconds(const FILETIME &time) {
+    ULARGE_INTEGER value;
+    value.LowPart = time.dwLowDateTime;
+    value.HighPart = time.dwHighDateTime;
+    return (int64_t)((value.QuadPart - 116444736000000000ULL) / 10000000ULL);
+}
+
+// Fill in an entry's metadata from the attributes Windows reports for it
+static void setAttributes(DirEntry &entry, DWORD attributes, DWORD sizeHigh, DWORD sizeLow, const FILETIME &writeTime) {
+    bool isDir = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    entry.type = isDir ? ENTRY_DIR : ENTRY_FILE;
+    entry.mode = isDir ? S_IFDIR : S_IFREG;
+    entry.size = ((int64_t)sizeHigh << 32) | sizeLow;
+    entry.mtime = unixSeconds(writeTime);
+    entry.flags |= ENTRY_HAS_STAT | ENTRY_STAT_OK;
+}
+#endif
+
+bool readDirectoryStamp(const std::string &dirPath, int64_t &mtime, int64_t &ctime) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+    if (!GetFileAttributesEx(dirPath.c_str(), GetFileExInfoStandard, &fileInfo)) {
+        return false;
+    }
+    ULARGE_INTEGER writeTime;
+    writeTime.LowPart = fileInfo.ftLastWriteTime.dwLowDateTime;
+    writeTime.HighPart = fileInfo.ftLastWriteTime.dwHighDateTime;
+    mtime = (int64_t)writeTime.QuadPart * 100;
+    ctime = mtime;  // Windows doesn't track an inode change time
+#else
+    struct stat dirStat;
+    if (stat(dirPath.c_str(), &dirStat) != 0) {
+        return false;
+    }
+    stampFromStat(dirStat, mtime, ctime);
+#endif
+    return true;
+}
+
+#ifndef _WIN32
+void stampFromStat(const struct stat &st, int64_t &mtime, int64_t &ctime) {
+#ifdef __APPLE__
+    mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+    ctime = (int64_t)st.st_ctimespec.tv_sec * 1000000000 + st.st_ctimespec.tv_nsec;
+#else
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    ctime = (int64_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+}
+#endif
+
+size_t listingBytes(const DirListing &listing) {
+    return sizeof(DirListing) + listing.path.capacity() + listing.names.capacity() +
+           listing.entries.capacity() * sizeof(DirEntry);
+}
+
+DirEntry &addEntry(DirListing &listing, std::string_view name, uint8_t type) {
+    DirEntry entry = {};
+    entry.nameOffset = (uint32_t)listing.names.size();
+    entry.nameLength = (uint16_t)name.size();
+    entry.type = type;
+    listing.names.append(name.data(), name.size());
+    listing.names.push_back('\0');  // so names can be passed straight to fstatat()
+    listing.entries.push_back(entry);
+    return listing.entries.back();
+}
+
+// Function to get directory contents. Only names and types are read here; no
+// per-entry stat() is done so the listing can be drawn right away.
+DirListing getDirectoryContents(const std::string &dirPath, const BatchCallback &onBatch) {
+    TraceTimer timer(TRACE_READDIR, dirPath);
+    DirListing listing;
+    listing.path = dirPath;
+
+    // Taken before reading so changes made while we read invalidate the listing
+    readDirectoryStamp(dirPath, listing.dirMtime, listing.dirCtime);
+
+#ifdef _WIN32
+    // The enumeration reports sizes, times and attributes along with the
+    // names, so entries come with their metadata and need no stat of their
+    // own: one round trip per buffer of entries rather than one per entry
+    // on a share. Basic info skips the 8.3 short names, and a large fetch
+    // asks for bigger buffers at a time.
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileExA((dirPath + "\\*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    if (find != INVALID_HANDLE_VALUE) {
+        listing.readable = true;
+        do {
+            DirEntry &entry = addEntry(listing, data.cFileName, ENTRY_UNKNOWN);
+            setAttributes(entry, data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime);
+            if (onBatch && listing.entries.size() % LOAD_BATCH == 0 && !onBatch(listing)) {
+                break;
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+        if (onBatch) {
+            onBatch(listing);
+        }
+    }
+#else
+    DIR *dir;
+    struct dirent *ent;
+    if ((dir = opendir(dirPath.c_str())) != NULL) {
+        listing.readable = true;
+        while ((ent = readdir(dir)) != NULL) {
+            addEntry(listing, ent->d_name, typeFromDirent(ent->d_type));
+            if (onBatch && listing.entries.size() % LOAD_BATCH == 0 && !onBatch(listing)) {
+                break;
+            }
+        }
+        listing.dir.reset(dir, closedir);
+        if (onBatch) {
+            onBatch(listing);
+        }
+    }
+#endif
+
+    timer.setItems(listing.entries.size());
+    return listing;
+}
+
+int findEntry(const DirListing &listing, std::string_view name, int hint) {
+    if (hint >= 0 && hint < (int)listing.entries.size() && listing.nameView(listing.entries[hint]) == name) {
+        return hint;  // usually nothing moved
+    }
+    for (size_t i = 0; i < listing.entries.size(); i++) {
+        if (listing.entries[i].nameLength == name.size() && listing.nameView(listing.entries[i]) == name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void statEntry(const char *path, DirEntry &entry) {
+    entry.flags |= ENTRY_HAS_STAT;
+#ifdef _WIN32
+    // For Windows, retrieve file attributes using the Windows API
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+    if (GetFileAttributesEx(path, GetFileExInfoStandard, &fileInfo)) {
+        setAttributes(entry, fileInfo.dwFileAttributes, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow,
+                      fileInfo.ftLastWriteTime);
+    }
+#else
+    struct stat fileStat;
+    if (stat(path, &fileStat) == 0) {
+        entry.type = typeFromMode(fileStat.st_mode);
+        entry.mode = fileStat.st_mode;
+        entry.size = fileStat.st_size;
+        entry.mtime = fileStat.st_mtime;
+        entry.flags |= ENTRY_STAT_OK;
+    }
+#endif
+}
+
+void statListed(const DirListing &listing, DirEntry &entry, PathBuffer &path) {
+    TraceTimer timer(TRACE_STAT);
+    entry.flags |= ENTRY_HAS_STAT;  // don't retry entries that vanished or can't be stat'ed
+#ifndef _WIN32
+    // Unix-like systems: stat relative to the open directory, no path building
+    if (listing.dir) {
+        struct stat fileStat;
+        if (fstatat(dirfd(listing.dir.get()), listing.name(entry), &fileStat, 0) == 0) {
+            entry.type = typeFromMode(fileStat.st_mode);
+            entry.mode = fileStat.st_mode;
+            entry.size = fileStat.st_size;
+            entry.mtime = fileStat.st_mtime;
+            entry.flags |= ENTRY_STAT_OK;
+        }
+        return;
+    }
+#endif
+    // Listings that no longer hold their directory open fall back to the full path
+    statEntry(path.join(listing.path, listing.nameView(entry)).c_str(), entry);
+}
+
+void fillMetadata(DirListing &listing, size_t begin, size_t end) {
+    TraceTimer timer(TRACE_METADATA, listing.path);
+    size_t statted = 0;
+    PathBuffer path;
+    end = std::min(end, listing.entries.size());
+    for (size_t i = begin; i < end; i++) {
+        DirEntry &entry = listing.entries[i];
+        if (!(entry.flags & ENTRY_HAS_STAT)) {
+            statListed(listing, entry, path);
+            statted++;
+        }
+    }
+    timer.setItems(statted);
+}
+
+#ifndef _WIN32
+void formatPermissions(uint32_t mode, char *out) {
+    out[0] = (S_ISDIR(mode)) ? 'd' : '-';
+    out[1] = (mode & S_IRUSR) ? 'r' : '-';
+    out[2] = (mode & S_IWUSR) ? 'w' : '-';
+    out[3] = (mode & S_IXUSR) ? 'x' : '-';
+    out[4] = (mode & S_IRGRP) ? 'r' : '-';
+    out[5] = (mode & S_IWGRP) ? 'w' : '-';
+    out[6] = (mode & S_IXGRP) ? 'x' : '-';
+    out[7] = (mode & S_IROTH) ? 'r' : '-';
+    out[8] = (mode & S_IWOTH) ? 'w' : '-';
+    out[9] = (mode & S_IXOTH) ? 'x' : '-';
+    out[PERMISSIONS_LENGTH] = '\0';
+}
+#endif
+
+int formatEntry(const DirListing &listing, const DirEntry &entry, char *buf, size_t size) {
+    const char *name = listing.name(entry);
+    char typeChar = listing.isDir(entry) ? 'd' : '-';
+    int length;
+
+    if (!(entry.flags & ENTRY_STAT_OK)) {
+        // Metadata not fetched yet (or stat failed): show what readdir told us
+        length = snprintf(buf, size, "%c?????????    %s", typeChar, name);
+    } else {
+        time_t mtime = (time_t)entry.mtime;
+        struct tm *timeInfo = localtime(&mtime);
+#ifdef _WIN32
+        length = snprintf(buf, size, "%c    %02d/%02d/%04d    %02d:%02d    %s", typeChar,
+                          timeInfo->tm_mday, timeInfo->tm_mon + 1, timeInfo->tm_year + 1900,
+                          timeInfo->tm_hour, timeInfo->tm_min, name);
+#else
+        char perms[PERMISSIONS_LENGTH + 1];
+        char timeBuf[80];
+        formatPermissions(entry.mode, perms);
+        strftime(timeBuf, sizeof(timeBuf), "%b %d %H:%M", timeInfo);
+        length = snprintf(buf, size, "%s %lld %s %s", perms, (long long)entry.size, timeBuf, name);
+#endif
+    }
+
+    return std::max(0, std::min(length, (int)size - 1));
+}
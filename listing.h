@@ -0,0 +1,135 @@
+#ifndef LISTING_H_INCLUDED
+#define LISTING_H_INCLUDED
+
+#include <dirent.h>
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Entry types, from d_type at first and from st_mode once the entry has been stat'ed
+enum EntryType : uint8_t {
+    ENTRY_UNKNOWN,
+    ENTRY_FILE,
+    ENTRY_DIR,
+    ENTRY_LINK,
+    ENTRY_OTHER
+};
+
+// DirEntry::flags
+enum : uint8_t {
+    ENTRY_HAS_STAT = 1 << 0,  // fillMetadata() has visited this entry
+    ENTRY_STAT_OK = 1 << 1,   // ...and mode, size and mtime are valid
+    ENTRY_TOTAL_SIZE = 1 << 2, // size is the recursive total from a DirSizer
+    ENTRY_MARKED = 1 << 3      // picked for a file operation
+};
+
+// A single directory entry. Entries are plain data stored contiguously in a
+// DirListing; the name lives in the listing's shared name arena.
+struct DirEntry {
+    uint32_t nameOffset;  // into DirListing::names, NUL terminated
+    uint16_t nameLength;
+    uint8_t type;         // EntryType
+    uint8_t flags;
+    uint32_t mode;
+    int64_t size;
+    int64_t mtime;
+};
+
+// Contents of one directory. The directory stays open for as long as the
+// listing is alive so metadata can be fetched relative to it with fstatat().
+struct DirListing {
+    std::string path;
+    std::string names;  // name arena
+    std::vector<DirEntry> entries;
+    bool readable = false;  // the directory could be opened
+    int64_t dirMtime = 0;   // the directory's own mtime and ctime (ns) when reading started,
+    int64_t dirCtime = 0;   // for telling whether a cached copy is still current
+#ifndef _WIN32
+    std::shared_ptr<DIR> dir;
+#endif
+
+    const char *name(const DirEntry &entry) const { return names.data() + entry.nameOffset; }
+    std::string_view nameView(const DirEntry &entry) const { return std::string_view(name(entry), entry.nameLength); }
+    bool isDir(const DirEntry &entry) const { return entry.type == ENTRY_DIR; }
+};
+
+// Builds "dir/name" paths in a buffer that is kept from one path to the next,
+// so once it has grown to fit, making a path per entry doesn't allocate. Use
+// one per thread.
+class PathBuffer {
+public:
+    // The path of name in dir; valid until the next call
+    const std::string &join(std::string_view dir, std::string_view name) {
+        path.assign(dir.data(), dir.size());
+        path.push_back('/');
+        path.append(name.data(), name.size());
+        return path;
+    }
+
+private:
+    std::string path;
+};
+
+// Number of entries read between calls to a BatchCallback
+const size_t LOAD_BATCH = 1024;
+
+// Called with the listing so far while a directory is being read; return false to stop early
+typedef std::function<bool(const DirListing &listing)> BatchCallback;
+
+// Length of a formatted permission string, not counting the terminating NUL
+const size_t PERMISSIONS_LENGTH = 10;
+
+// Function to get directory contents (names and types only, except on
+// Windows, where the enumeration brings the metadata along). onBatch, if
+// given, is called every LOAD_BATCH entries and once more at the end.
+DirListing getDirectoryContents(const std::string &dirPath, const BatchCallback &onBatch = nullptr);
+
+#ifndef _WIN32
+// Map a readdir() d_type to an EntryType
+uint8_t typeFromDirent(unsigned char dType);
+
+// Map a stat() st_mode to an EntryType
+uint8_t typeFromMode(uint32_t mode);
+#endif
+
+// Read a directory's mtime and ctime in nanoseconds; false if it can't be stat'ed
+bool readDirectoryStamp(const std::string &dirPath, int64_t &mtime, int64_t &ctime);
+
+#ifndef _WIN32
+// The mtime and ctime in nanoseconds of what st describes, as readDirectoryStamp() gives them
+void stampFromStat(const struct stat &st, int64_t &mtime, int64_t &ctime);
+#endif
+
+// Approximate heap memory held by a listing
+size_t listingBytes(const DirListing &listing);
+
+// Append an entry to the listing, copying its name into the arena
+DirEntry &addEntry(DirListing &listing, std::string_view name, uint8_t type);
+
+// Index of the entry called name, trying hint first; -1 if there is none
+int findEntry(const DirListing &listing, std::string_view name, int hint);
+
+// Fetch size/mtime/permissions for one entry from its full path
+void statEntry(const char *path, DirEntry &entry);
+
+// Fetch size/mtime/permissions for one entry of the listing, relative to its
+// open directory or else by full path, built in path
+void statListed(const DirListing &listing, DirEntry &entry, PathBuffer &path);
+
+// Fetch size/mtime/permissions for entries [begin, end) that don't have them yet
+void fillMetadata(DirListing &listing, size_t begin, size_t end);
+
+#ifndef _WIN32
+// Function to format permissions into out[PERMISSIONS_LENGTH + 1] (Unix-like systems only)
+void formatPermissions(uint32_t mode, char *out);
+#endif
+
+// Function to format one listing row into buf; returns the row length
+int formatEntry(const DirListing &listing, const DirEntry &entry, char *buf, size_t size);
+
+#endif // LISTING_H_INCLUDED
@@ -0,0 +1,249 @@
+#include "loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "events.h"
+#include "metadata.h"
+
+// Metadata fetched for one entry, addressed by its index in the listing
+struct MetadataUpdate {
+    uint32_t index;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t mode;
+    int64_t size;
+    int64_t mtime;
+};
+
+// State shared between a DirLoader and its worker thread. The worker owns it
+// jointly with the loader, so a cancelled job can finish on its own time.
+struct LoadJob {
+    std::string path;
+    std::atomic<bool> cancelled{false};
+    std::mutex visibleMutex;
+    std::vector<uint32_t> visible;           // entries on screen
+    std::atomic<unsigned> visibleVersion{0}; // bumped whenever visible changes
+
+    std::mutex mutex;  // protects everything below
+    std::string names;                      // names of entries not drained yet
+    std::vector<DirEntry> entries;          // nameOffset is relative to names
+    std::vector<MetadataUpdate> updates;
+    int64_t dirMtime = 0;
+    int64_t dirCtime = 0;
+    bool finished = false;
+    bool failed = false;
+    bool drained = false;  // finished, and everything has been handed to the UI
+};
+
+// Stat updates are handed over in batches of this size, unless they are for rows on screen
+static const size_t UPDATE_BATCH = 256;
+
+// Entries stat'ed at once by the MetadataFetcher
+static const size_t STAT_BATCH = 64;
+
+// Hand entries [published, end) of the worker's listing over to the UI
+static void publishEntries(LoadJob &job, const DirListing &local, size_t &published) {
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.dirMtime = local.dirMtime;
+    job.dirCtime = local.dirCtime;
+    for (size_t i = published; i < local.entries.size(); i++) {
+        DirEntry entry = local.entries[i];
+        std::string_view name = local.nameView(entry);
+        entry.nameOffset = (uint32_t)job.names.size();
+        job.names.append(name.data(), name.size());
+        job.names.push_back('\0');
+        job.entries.push_back(entry);
+    }
+    published = local.entries.size();
+    wakeUi();
+}
+
+static void publishUpdates(LoadJob &job, std::vector<MetadataUpdate> &batch) {
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.updates.insert(job.updates.end(), batch.begin(), batch.end());
+    batch.clear();
+    wakeUi();
+}
+
+// The next entries to stat, up to STAT_BATCH of them: entries on screen
+// first, then in listing order. Returns true if some are on screen.
+static bool nextToStat(const std::vector<uint32_t> &visible, const DirListing &local, size_t &next,
+                       std::vector<uint32_t> &toStat) {
+    toStat.clear();
+    for (uint32_t i : visible) {
+        if (i < local.entries.size() && !(local.entries[i].flags & ENTRY_HAS_STAT) && toStat.size() < STAT_BATCH) {
+            toStat.push_back(i);
+        }
+    }
+    bool onScreen = !toStat.empty();
+    while (next < local.entries.size() && (local.entries[next].flags & ENTRY_HAS_STAT)) {
+        next++;
+    }
+    for (size_t i = next; i < local.entries.size() && toStat.size() < STAT_BATCH; i++) {
+        if (!(local.entries[i].flags & ENTRY_HAS_STAT) &&
+            (!onScreen || std::find(visible.begin(), visible.end(), (uint32_t)i) == visible.end())) {
+            toStat.push_back((uint32_t)i);
+        }
+    }
+    return onScreen;
+}
+
+// Stat the entries of the worker's listing, on-screen ones first, and hand
+// the results over until all are done or the job is cancelled; then finish
+static void fetchMetadata(LoadJob &job, DirListing &local) {
+    MetadataFetcher fetcher;
+    std::vector<MetadataUpdate> batch;
+    std::vector<uint32_t> visible;  // copy of job.visible as of visibleVersion
+    std::vector<uint32_t> toStat;
+    unsigned visibleVersion = 0;
+    size_t next = 0;
+    while (!job.cancelled) {
+        if (visibleVersion != job.visibleVersion) {
+            std::lock_guard<std::mutex> lock(job.visibleMutex);
+            visible = job.visible;
+            visibleVersion = job.visibleVersion;
+        }
+        bool onScreen = nextToStat(visible, local, next, toStat);
+        if (toStat.empty()) {
+            break;
+        }
+        fetcher.fetch(local, toStat);
+
+        for (uint32_t index : toStat) {
+            const DirEntry &entry = local.entries[index];
+            batch.push_back({index, entry.type, entry.flags, entry.mode, entry.size, entry.mtime});
+        }
+        if (onScreen || batch.size() >= UPDATE_BATCH) {
+            publishUpdates(job, batch);
+        }
+    }
+
+    publishUpdates(job, batch);
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.failed = !local.readable;
+    job.finished = true;
+    wakeUi();
+}
+
+// Worker thread body
+static void loadDirectory(std::shared_ptr<LoadJob> job) {
+    size_t published = 0;
+    DirListing local = getDirectoryContents(job->path, [&](const DirListing &listing) {
+        publishEntries(*job, listing, published);
+        return !job->cancelled;
+    });
+    fetchMetadata(*job, local);
+}
+
+// Worker thread body for a listing that only needs its metadata
+static void loadMetadata(std::shared_ptr<LoadJob> job, DirListing local) {
+#ifndef _WIN32
+    // Stat relative to the directory, as for a listing read from disk
+    if (DIR *dir = opendir(local.path.c_str())) {
+        local.dir.reset(dir, closedir);
+    }
+#endif
+    fetchMetadata(*job, local);
+}
+
+DirLoader::~DirLoader() {
+    cancel();
+}
+
+void DirLoader::start(const std::string &path) {
+    cancel();
+    job = std::make_shared<LoadJob>();
+    job->path = path;
+    std::thread(loadDirectory, job).detach();
+}
+
+void DirLoader::startMetadata(const DirListing &listing) {
+    cancel();
+    job = std::make_shared<LoadJob>();
+    job->path = listing.path;
+    job->dirMtime = listing.dirMtime;
+    job->dirCtime = listing.dirCtime;
+    std::thread(loadMetadata, job, listing).detach();
+}
+
+void DirLoader::cancel() {
+    if (job) {
+        job->cancelled = true;
+        job.reset();
+    }
+}
+
+bool DirLoader::drain(DirListing &listing) {
+    if (!job) {
+        return false;
+    }
+
+    std::string names;
+    std::vector<DirEntry> entries;
+    std::vector<MetadataUpdate> updates;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        names.swap(job->names);
+        entries.swap(job->entries);
+        updates.swap(job->updates);
+        listing.dirMtime = job->dirMtime;
+        listing.dirCtime = job->dirCtime;
+        listing.readable = job->finished && !job->failed;
+        job->drained = job->finished;
+    }
+
+    // New entries: append their names to the listing's arena and rebase
+    uint32_t base = (uint32_t)listing.names.size();
+    listing.names += names;
+    for (DirEntry &entry : entries) {
+        entry.nameOffset += base;
+        listing.entries.push_back(entry);
+    }
+
+    for (const MetadataUpdate &update : updates) {
+        if (update.index < listing.entries.size()) {
+            DirEntry &entry = listing.entries[update.index];
+            entry.type = update.type;
+            entry.mode = update.mode;
+            entry.mtime = update.mtime;
+            if (!(entry.flags & ENTRY_TOTAL_SIZE)) {
+                entry.size = update.size;  // else keep a recursive size already shown
+            }
+            entry.flags = update.flags | (entry.flags & (ENTRY_TOTAL_SIZE | ENTRY_MARKED));
+        }
+    }
+
+    return !entries.empty() || !updates.empty();
+}
+
+bool DirLoader::busy() const {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return !job->drained;
+}
+
+bool DirLoader::failed() const {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return job->drained && job->failed;
+}
+
+void DirLoader::setVisible(const std::vector<uint32_t> &indices) {
+    if (!job) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(job->visibleMutex);
+    if (job->visible != indices) {
+        job->visible = indices;
+        job->visibleVersion++;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef LOADER_H_INCLUDED
+#define LOADER_H_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "listing.h"
+
+struct LoadJob;
+
+// Reads a directory on a worker thread. Names arrive in batches first, then
+// metadata, with the rows on screen stat'ed before the rest; the UI thread
+// picks both up with drain() without ever blocking on the filesystem.
+class DirLoader {
+public:
+    ~DirLoader();
+
+    // Start loading path, cancelling any load still in progress
+    void start(const std::string &path);
+
+    // Start fetching only the metadata of a listing whose names are known
+    // already, as from a TreeIndex, cancelling any load still in progress
+    void startMetadata(const DirListing &listing);
+
+    // Stop the current load; its thread exits at the next entry
+    void cancel();
+
+    // Move everything found since the last call into listing. Returns true if
+    // rows were added or updated.
+    bool drain(DirListing &listing);
+
+    // True until the current load has finished and been fully drained
+    bool busy() const;
+
+    // True if the directory could not be opened
+    bool failed() const;
+
+    // Tell the worker which entries are on screen so they get their metadata first
+    void setVisible(const std::vector<uint32_t> &indices);
+
+private:
+    std::shared_ptr<LoadJob> job;
+};
+
+#endif // LOADER_H_INCLUDED
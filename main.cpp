@@ -3,10 +3,27 @@
 #include <string>
 #include <vector>
 #include <cstring>
-#include <iomanip>
-#include <sstream>
-#include <fstream> // For reading files
 #include <stack> // For backward/forward navigation
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "batch.h"
+#include "dircache.h"
+#include "events.h"
+#include "fileops.h"
+#include "finder.h"
+#include "grep.h"
+#include "listing.h"
+#include "loader.h"
+#include "prefetch.h"
+#include "preview.h"
+#include "trace.h"
+#include "treeindex.h"
+#include "view.h"
+#include "viewer.h"
+#include "walker.h"
+#include "watcher.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -22,305 +39,1155 @@
 #include <signal.h>
 #include <grp.h>
 #include <unistd.h>
-#include <sys/wait.h>  // For handling child processes
 #include <time.h>
 #endif
 
-// Function to format permissions (Unix-like systems only)
-#ifndef _WIN32
-std::string formatPermissions(mode_t mode) {
-    std::string perms = (S_ISDIR(mode)) ? "d" : "-";
-    perms += (mode & S_IRUSR) ? "r" : "-";
-    perms += (mode & S_IWUSR) ? "w" : "-";
-    perms += (mode & S_IXUSR) ? "x" : "-";
-    perms += (mode & S_IRGRP) ? "r" : "-";
-    perms += (mode & S_IWGRP) ? "w" : "-";
-    perms += (mode & S_IXGRP) ? "x" : "-";
-    perms += (mode & S_IROTH) ? "r" : "-";
-    perms += (mode & S_IWOTH) ? "w" : "-";
-    perms += (mode & S_IXOTH) ? "x" : "-";
-    return perms;
+// How often the directory loop refreshes what counts up without waking it:
+// recursive sizes, and how far a find or grep has got
+const int PROGRESS_POLL_MS = 100;
+
+// Background updates are repainted at most this often; a burst of them in
+// between comes out as one repaint
+const int FRAME_MS = 33;
+
+// How often a view sorted by size or time is sorted again while metadata is still arriving
+const int RESORT_INTERVAL_MS = 250;
+
+// What the listing holds when it isn't the directory itself
+enum ResultsKind {
+    RESULTS_NONE,
+    RESULTS_FIND,  // entries found by name
+    RESULTS_GREP   // lines found in file contents
+};
+
+// A directory in the back/forward history, with where the view was
+struct HistoryEntry {
+    std::string path;
+    std::string selected;  // name of the selected entry
+    int choice = 0;
+    int topRow = 0;
+};
+
+// Everything the directory view keeps track of
+struct Browser {
+    std::string currentDir;
+    DirListing listing;
+    ListingView view;         // the order entries are shown in; choice and topRow index it
+    bool viewStale = false;   // entries changed in ways that may have upset the order
+    std::string filterText;   // as typed; view.filter is its lowercase form
+    bool editingFilter = false;
+    std::chrono::steady_clock::time_point sortedAt;
+    DirLoader loader;
+    DirCache cache;
+    Prefetcher prefetcher;    // reads ahead what Enter on the selection would open
+    Previewer previewer;
+    Preview preview;          // the latest preview made, of the selection or one before it
+    bool showPreview = false; // the preview pane is on
+    DirWatcher watcher;
+    std::vector<WatchEvent> watchEvents;  // seen but not applied yet
+    DirSizer sizer;
+    std::vector<int> sizerIndex;  // where each of the sizer's entries was last seen
+    DirFinder finder;
+    FileGrep grep;
+    FileOperation fileOp;
+    std::shared_ptr<const TreeIndex> index;  // covering the current directory, if there is one
+    TreeIndexer indexer;
+    int marked = 0;           // entries with ENTRY_MARKED set
+    bool showTrace = false;   // the performance overlay is on
+    std::vector<GrepHit> grepHits;  // parallel to listing.entries for RESULTS_GREP
+    ResultsKind results = RESULTS_NONE;
+    std::string resultsPattern;
+    bool searchStopped = false;   // the find or grep was cancelled before it was done
+    std::string message;          // shown on the status line until the next key
+    int choice = 0;
+    int topRow = 0;           // The first entry shown in the viewport
+
+    // Track navigation history for back/forward functionality
+    std::stack<HistoryEntry> backStack;
+    std::stack<HistoryEntry> forwardStack;
+
+    // Selection to put back once a reloading directory has read that far;
+    // path is empty when there is none
+    HistoryEntry pendingRestore;
+};
+
+// Function to get the entry shown at a position in the view, if there is one
+const DirEntry *entryAt(const Browser &browser, int position) {
+    if (position < 0 || position >= (int)browser.view.size()) {
+        return nullptr;
+    }
+    return &browser.listing.entries[browser.view.order[position]];
 }
-#endif
 
-void handle_resize(int sig){
-    clear();
-    refresh();
-    getmaxyx(stdscr, LINES, COLS);
-    mvprintw(0,0, "New Size: %dx%d", COLS, LINES);
+// Function to get the listing index of the selected entry, or -1
+int selectedIndex(const Browser &browser) {
+    const DirEntry *entry = entryAt(browser, browser.choice);
+    return entry ? (int)browser.view.order[browser.choice] : -1;
 }
 
-// Function to get directory contents
-std::vector<std::string> getDirectoryContents(const std::string &dirPath) {
-    std::vector<std::string> contents;
-    DIR *dir;
-    struct dirent *ent;
+// Narrowest screen the preview pane is shown on
+static const int PREVIEW_MIN_COLS = 40;
 
-    if ((dir = opendir(dirPath.c_str())) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            std::string fileName = ent->d_name;
-            std::string fullPath = dirPath + "/" + fileName;
+// Function to get how many columns the listing may use: all of them, or the
+// left half when the preview pane is shown
+int listingWidth(const Browser &browser) {
+    return browser.showPreview && COLS >= PREVIEW_MIN_COLS ? COLS / 2 : COLS;
+}
 
-#ifdef _WIN32
-            // For Windows, retrieve file attributes using the Windows API
-            WIN32_FILE_ATTRIBUTE_DATA fileInfo;
-            if (GetFileAttributesEx(fullPath.c_str(), GetFileExInfoStandard, &fileInfo)) {
-                SYSTEMTIME st;
-                FileTimeToSystemTime(&fileInfo.ftLastWriteTime, &st);
-
-                std::stringstream entry;
-                entry << ((fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? "d" : "-")
-                      << "    " << std::setfill('0')<< std::setw(2) << st.wDay << "/" << std::setw(2) << st.wMonth << "/"<< std::setw(4) << st.wYear
-                      << "    " << std::setw(2) << st.wHour << ":" << std::setw(2) << st.wMinute << "    " << fileName;
-
-                contents.push_back(entry.str());
-            }
-#else
-            // Unix-like systems: use stat to get file metadata
-            struct stat fileStat;
-            if (stat(fullPath.c_str(), &fileStat) == 0) {
-                std::stringstream entry;
-                entry << formatPermissions(fileStat.st_mode) << " ";
-                entry << fileStat.st_size << " "; // File size
-                char timeBuf[80];
-                struct tm *timeInfo = localtime(&fileStat.st_mtime);
-                strftime(timeBuf, sizeof(timeBuf), "%b %d %H:%M", timeInfo);
-                entry << timeBuf << " ";
-                entry << fileName;
-
-                contents.push_back(entry.str());
-            }
-#endif
+// Function to draw one row of the directory listing viewport, leaving the
+// preview pane beside it alone
+void drawListingRow(const Browser &browser, int position, bool highlighted) {
+    move(position - browser.topRow + 1, 0);
+    hline(' ', listingWidth(browser));
+    const DirEntry *entry = entryAt(browser, position);
+    if (!entry) {
+        return;
+    }
+
+    if (browser.results == RESULTS_GREP) {
+        // Hits are "path:line: text" and have no metadata worth showing
+        std::string_view name = browser.listing.nameView(*entry);
+        if (highlighted) {
+            attron(A_REVERSE);
         }
-        closedir(dir);
+        addnstr(name.data(), (int)std::min(name.size(), (size_t)listingWidth(browser)));
+        if (highlighted) {
+            attroff(A_REVERSE);
+        }
+        return;
     }
 
-    return contents;
+    char row[512];
+    int length = formatEntry(browser.listing, *entry, row, sizeof(row));
+    attr_t attributes = (highlighted ? A_REVERSE : 0) | ((entry->flags & ENTRY_MARKED) ? A_BOLD : 0);
+    attron(attributes);
+    addnstr(row, std::min(length, listingWidth(browser)));
+    attroff(attributes);
 }
 
-// Function to check if the file is readable
-bool isReadable(const std::string &filePath) {
-    std::ifstream file(filePath);
-    return file.good();
+// Function to get the path of what the preview pane shows for the selection,
+// or "" if it shows nothing
+std::string previewPath(const Browser &browser) {
+    const DirEntry *entry = entryAt(browser, browser.choice);
+    if (!entry || browser.results == RESULTS_GREP) {
+        return "";
+    }
+    return browser.currentDir + "/" + browser.listing.name(*entry);
 }
 
-// Function to open the file with the default application if it is not readable
-void openWithDefaultApplication(const std::string &filePath) {
-#ifdef _WIN32
-    // Use ShellExecute to open the file in the default application on Windows
-    ShellExecute(NULL, "open", filePath.c_str(), NULL, NULL, SW_SHOWNORMAL);
-#else
-    // Unix-like systems: Use fork and exec to open the file with default application
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process: Try to open the file using `xdg-open` or `open` for macOS
-        execlp("xdg-open", "xdg-open", filePath.c_str(), (char *)NULL);  // For Linux
-        execlp("open", "open", filePath.c_str(), (char *)NULL);          // For macOS
-        exit(1);  // If exec fails, terminate child process
-    } else if (pid > 0) {
-        // Parent process: Wait for child to complete
-        int status;
-        waitpid(pid, &status, 0);
+// Function to draw the preview pane right of the listing: the selection's
+// preview if current, that is once it has been made, and nothing until then
+void drawPreview(const Browser &browser, int listRows, bool current) {
+    int left = listingWidth(browser);
+    if (left == COLS) {
+        return;
+    }
+    mvvline(1, left, ACS_VLINE, listRows);
+    std::string out;
+    for (int row = 0; row < listRows; row++) {
+        move(row + 1, left + 1);
+        clrtoeol();
+        if (current && row < (int)browser.preview.lines.size()) {
+            drawTextLine(row + 1, left + 1, browser.preview.lines[row], 0, COLS - left - 1, out);
+        }
     }
-#endif
 }
 
-// Modified function to display file content with scrollable functionality
-void displayFileContent(const std::string &filePath) {
-    // First, check if the file is readable
-    if (!isReadable(filePath)) {
-        mvprintw(0, 0, "File not readable. Opening with default application...");
-        refresh();
-        openWithDefaultApplication(filePath);  // Open with the default application
-        return;  // Exit this function after launching the external application
+// Function to format a byte count for the status line, such as "3.4 MB"
+void formatBytes(uint64_t bytes, char *out, size_t size) {
+    static const char *units[] = {"bytes", "KB", "MB", "GB", "TB"};
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(out, size, unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+}
+
+// Function to describe how far the file operation has got
+std::string fileOpStatus(const FileOpProgress &progress) {
+    char text[160];
+    if (progress.planning) {
+        snprintf(text, sizeof(text), "%s: %llu entries to go so far", fileOpVerb(progress.kind),
+                 (unsigned long long)progress.filesTotal);
+        return text;
+    }
+    int length = snprintf(text, sizeof(text), "%s %llu/%llu", fileOpVerb(progress.kind),
+                          (unsigned long long)progress.filesDone, (unsigned long long)progress.filesTotal);
+    if (progress.bytesTotal > 0) {
+        char done[32], total[32], rate[32];
+        formatBytes(progress.bytesDone, done, sizeof(done));
+        formatBytes(progress.bytesTotal, total, sizeof(total));
+        formatBytes((uint64_t)progress.bytesPerSecond, rate, sizeof(rate));
+        snprintf(text + length, sizeof(text) - length, ", %s of %s, %s/s", done, total, rate);
+    }
+    return text;
+}
+
+// Function to format a count with a K, M or G suffix, such as "3.9M"
+void formatCount(double count, char *out, size_t size) {
+    static const char *suffixes[] = {"", "K", "M", "G"};
+    int suffix = 0;
+    while (count >= 1000 && suffix < 3) {
+        count /= 1000;
+        suffix++;
     }
+    snprintf(out, size, suffix == 0 ? "%.0f%s" : "%.1f%s", count, suffixes[suffix]);
+}
 
-    // Continue with the previous logic if the file is readable
-    std::ifstream file(filePath);
-    if (!file) {
-        mvprintw(0, 0, "Error: Unable to open file");
+// Function to draw the performance overlay above the status line: for each
+// kind of traced operation, how often it ran, how long it took and how many
+// things it got through per second
+void drawTraceOverlay() {
+    int top = LINES - 2 - TRACE_OP_COUNT;
+    if (top < 1) {
         return;
     }
+    int width = std::min(COLS, 78);
+    int left = COLS - width;
+    char line[128];
+    attron(A_REVERSE);
+    snprintf(line, sizeof(line), " %-9s%8s%10s%11s%10s%10s  %-16s", "op", "calls", "items", "total ms", "avg ms",
+             "max ms", "rate");
+    mvaddnstr(top, left, line, width);
+    attroff(A_REVERSE);
+    for (int op = 0; op < TRACE_OP_COUNT; op++) {
+        TraceTotals totals = traceTotals((TraceOp)op);
+        char items[16], rate[32];
+        formatCount((double)totals.items, items, sizeof(items));
+        rate[0] = '\0';
+        if (totals.ns > 0) {
+            formatCount(totals.items * 1e9 / totals.ns, rate, sizeof(rate));
+            snprintf(rate + strlen(rate), sizeof(rate) - strlen(rate), " %s/s", traceItemName((TraceOp)op));
+        }
+        snprintf(line, sizeof(line), " %-9s%8llu%10s%11.1f%10.3f%10.3f  %-16s", traceOpName((TraceOp)op),
+                 (unsigned long long)totals.calls, items, totals.ns / 1e6,
+                 totals.calls ? totals.ns / 1e6 / totals.calls : 0.0, totals.maxNs / 1e6, rate);
+        mvaddnstr(top + 1 + op, left, line, width);
+    }
+}
 
-    // Read all file lines into a vector for easy access
-    std::vector<std::string> lines;
-    std::string line;
-    while (std::getline(file, line)) {
-        lines.push_back(line);
+// Function to draw the status line below the directory listing
+void drawListingStatus(const Browser &browser) {
+    int shown = (int)browser.view.size();
+    char state[64] = "";
+    if (browser.finder.busy()) {
+        snprintf(state, sizeof(state), " (searching, %zu looked at)", browser.finder.scanned());
+    } else if (browser.grep.busy()) {
+        snprintf(state, sizeof(state), " (searching, %zu files read)", browser.grep.searched());
+    } else if (browser.indexer.active()) {
+        snprintf(state, sizeof(state), " (indexing, %zu looked at)", browser.indexer.scanned());
+    } else {
+        snprintf(state, sizeof(state), "%s", browser.loader.busy() ? " (loading)"
+                                           : browser.loader.failed() ? " (cannot read directory)"
+                                           : browser.grep.truncated() ? " (stopped at the hit limit)"
+                                           : browser.searchStopped ? " (stopped)"
+                                           : browser.sizer.active() ? " (sizing)" : "");
+    }
+    move(LINES - 1, 0);
+    clrtoeol();
+    if (!browser.message.empty()) {
+        mvprintw(LINES - 1, 0, "%s", browser.message.c_str());
+        return;
+    }
+    if (browser.editingFilter) {
+        mvprintw(LINES - 1, 0, "/%s", browser.filterText.c_str());
+        int x = getcurx(stdscr);
+        printw("  %d of %d match%s  Enter to keep, ESC to clear", shown, (int)browser.listing.entries.size(), state);
+        move(LINES - 1, x);
+        return;
+    }
+    mvprintw(LINES - 1, 0, "%d/%d%s  by %s%s", shown == 0 ? 0 : browser.choice + 1, shown, state,
+             sortModeName(browser.view.mode), browser.view.descending ? ", reversed" : "");
+    if (!browser.filterText.empty()) {
+        printw("  matching \"%s\"", browser.filterText.c_str());
+    }
+    if (browser.marked > 0) {
+        printw("  %d marked", browser.marked);
+    }
+    if (browser.fileOp.active()) {
+        printw("  %s", fileOpStatus(browser.fileOp.progress()).c_str());
+        return;
     }
+    printw("  Use arrow keys to navigate, ESC to exit");
+}
 
-    int totalLines = lines.size();
-    int visibleRows = LINES - 2;  // Subtract 2 for file name and status line
+// Function to move the selection to an entry, keeping it on the same screen row
+void selectEntry(Browser &browser, int entryIndex) {
+    int position = entryIndex < 0 ? -1 : viewPosition(browser.view, entryIndex);
+    if (position >= 0) {
+        browser.topRow = std::max(0, browser.topRow + position - browser.choice);
+        browser.choice = position;
+    }
+}
 
-    int topLine = 0;  // The first visible line
-    int currentLine = 0;  // The line the cursor is currently on
+// Function to sort the view again, with the selection following its entry
+void resortView(Browser &browser) {
+    int selected = selectedIndex(browser);
+    sortView(browser.view, browser.listing);
+    selectEntry(browser, selected);
+    browser.viewStale = false;
+    browser.sortedAt = std::chrono::steady_clock::now();
+}
 
-    int ch;
-    bool quit = false;
+// Function to change the filter, keeping the selection if it still matches
+void changeFilter(Browser &browser, const std::string &text) {
+    int selected = selectedIndex(browser);
+    browser.filterText = text;
+    setFilter(browser.view, browser.listing, text);
+    browser.choice = 0;
+    browser.topRow = 0;
+    selectEntry(browser, selected);
+}
 
-    while (!quit) {
-        erase();
+// Function to handle a key while the filter is being typed. Returns false for
+// keys that should be handled as usual, such as the arrow keys.
+bool editFilter(Browser &browser, int ch) {
+    if (ch == 10 || ch == KEY_ENTER) {
+        browser.editingFilter = false;
+    } else if (ch == 27) {
+        browser.editingFilter = false;
+        changeFilter(browser, "");
+    } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+        if (!browser.filterText.empty()) {
+            changeFilter(browser, browser.filterText.substr(0, browser.filterText.size() - 1));
+        }
+    } else if (ch >= 32 && ch < 256) {
+        changeFilter(browser, browser.filterText + (char)ch);
+    } else {
+        return false;
+    }
+    return true;
+}
 
-        // Display file name at the top
-        mvprintw(0, 0, "File: %s", filePath.c_str());
+// Function to tell whether a stale view should be sorted again now. While a
+// load is running only orders that depend on metadata are kept up to date.
+bool resortDue(const Browser &browser) {
+    if (!browser.viewStale) {
+        return false;
+    }
+    if (!browser.loader.busy()) {
+        return true;
+    }
+    bool byMetadata = browser.view.mode == SORT_SIZE || browser.view.mode == SORT_MTIME;
+    return byMetadata && std::chrono::steady_clock::now() - browser.sortedAt >=
+                         std::chrono::milliseconds(RESORT_INTERVAL_MS);
+}
 
-        // Display the visible portion of the file
-        for (int i = 0; i < visibleRows && (topLine + i) < totalLines; ++i) {
-            if (topLine + i == currentLine) {
-                attron(A_REVERSE);  // Highlight the current line
-            }
-            mvprintw(i + 1, 0, "%s", lines[topLine + i].c_str());
-            if (topLine + i == currentLine) {
-                attroff(A_REVERSE);
+// Function to remember where the view is in the current directory
+HistoryEntry currentPosition(const Browser &browser) {
+    HistoryEntry position;
+    position.path = browser.currentDir;
+    if (const DirEntry *entry = entryAt(browser, browser.choice)) {
+        position.selected = browser.listing.name(*entry);
+    }
+    position.choice = browser.choice;
+    position.topRow = browser.topRow;
+    return position;
+}
+
+// Function to read the current directory again from scratch, keeping the selection
+void reloadDirectory(Browser &browser) {
+    HistoryEntry here = currentPosition(browser);
+    browser.sizer.cancel();
+    browser.listing = DirListing();
+    browser.listing.path = browser.currentDir;
+    browser.marked = 0;
+    browser.view.clear();
+    browser.loader.start(browser.currentDir);
+    browser.watcher.watch(browser.currentDir);
+    browser.pendingRestore = here;
+}
+
+// Function to count the marked entries again, after some may have gone
+void countMarks(Browser &browser) {
+    browser.marked = 0;
+    for (const DirEntry &entry : browser.listing.entries) {
+        browser.marked += (entry.flags & ENTRY_MARKED) ? 1 : 0;
+    }
+}
+
+// Function to bring the listing up to date with what the watcher has seen.
+// Returns true if the listing changed.
+bool applyDirectoryChanges(Browser &browser) {
+    browser.watcher.poll(browser.watchEvents);
+    if (browser.results != RESULTS_NONE) {
+        browser.watchEvents.clear();  // results aren't watched
+        return false;
+    }
+    if (browser.watchEvents.empty() || browser.loader.busy()) {
+        return false;  // events seen during a load are applied once it is done
+    }
+
+    bool rescan = false;
+    for (const WatchEvent &event : browser.watchEvents) {
+        rescan = rescan || event.type == WATCH_RESCAN;
+    }
+
+    bool changed = true;
+    if (rescan) {
+        reloadDirectory(browser);
+    } else {
+        int selected = selectedIndex(browser);
+        std::vector<int32_t> remap;
+        bool added = false;
+        changed = applyWatchEvents(browser.listing, browser.watchEvents, remap, added);
+        if (changed) {
+            remapView(browser.view, browser.listing, remap);
+            selectEntry(browser, selected >= 0 ? remap[selected] : -1);
+            // Removing entries keeps the order, and changed sizes and times
+            // only matter to the orders by them
+            if (added || browser.view.mode == SORT_SIZE || browser.view.mode == SORT_MTIME) {
+                browser.viewStale = true;
             }
+            countMarks(browser);       // marked entries may have gone
+            // The listing is current again as of now, as far as the cache is concerned
+            readDirectoryStamp(browser.currentDir, browser.listing.dirMtime, browser.listing.dirCtime);
         }
+    }
+    browser.watchEvents.clear();
+    return changed;
+}
 
-        // Display navigation instructions at the bottom
-        mvprintw(LINES - 1, 0, "Use arrow keys to navigate, ESC to exit");
+// Function to start computing recursive sizes; all subdirectories if allDirs, else the selection
+void startSizing(Browser &browser, bool allDirs) {
+    const DirListing &listing = browser.listing;
+    std::vector<std::string> names;
+    int selected = selectedIndex(browser);
+    browser.sizerIndex.clear();
+    for (size_t i = 0; i < listing.entries.size(); i++) {
+        const DirEntry &entry = listing.entries[i];
+        std::string_view name = listing.nameView(entry);
+        bool wanted = allDirs ? listing.isDir(entry) && name != "." && name != ".."
+                              : (int)i == selected && listing.isDir(entry);
+        if (wanted) {
+            names.emplace_back(name);
+            browser.sizerIndex.push_back((int)i);
+        }
+    }
+    if (!names.empty()) {
+        browser.sizer.start(browser.currentDir, names, browser.index);
+    }
+}
 
-        // Handle user input
-        ch = getch();
-        switch (ch) {
-        case KEY_UP:
-            if (currentLine > 0) {
-                currentLine--;
-            }
-            if (currentLine < topLine) {
-                topLine--;
-            }
-            break;
-        case KEY_DOWN:
-            if (currentLine < totalLines - 1) {
-                currentLine++;
-            }
-            if (currentLine >= topLine + visibleRows) {
-                topLine++;
-            }
-            break;
-        case 27:  // ESC key to exit
-            quit = true;
-            break;
+// Function to copy the recursive sizes found so far into the listing.
+// Returns true if the listing changed.
+bool applyDirectorySizes(Browser &browser) {
+    DirSizer &sizer = browser.sizer;
+    if (!sizer.active()) {
+        return false;
+    }
+    bool finished = sizer.finished();  // checked first, so the totals below are final if it is set
+    for (size_t i = 0; i < sizer.count(); i++) {
+        int index = findEntry(browser.listing, sizer.name(i), browser.sizerIndex[i]);
+        if (index >= 0) {
+            DirEntry &entry = browser.listing.entries[index];
+            entry.size = sizer.total(i);
+            entry.flags |= ENTRY_TOTAL_SIZE;
+            browser.sizerIndex[i] = index;
+        }
+    }
+    if (finished) {
+        sizer.clear();
+        browser.viewStale = browser.viewStale || browser.view.mode == SORT_SIZE;
+    }
+    return true;
+}
+
+// Function to pick how long the directory loop may wait with nothing
+// happening. The loader, the searches, the watcher and exiting applications
+// wake it up themselves; only counters are polled.
+int idleTimeout(const Browser &browser) {
+    if (browser.finder.busy() || browser.grep.busy() || browser.sizer.active() || browser.fileOp.active() ||
+        browser.indexer.active() || browser.showTrace) {
+        return PROGRESS_POLL_MS;
+    }
+    return -1;
+}
+
+// Function to wait for the next key. Returns ERR when there is something else
+// to look at instead, holding it back until a frame has passed since lastFrame.
+int waitForKey(const Browser &browser, std::chrono::steady_clock::time_point lastFrame) {
+    // getch() also puts what has been drawn on the screen
+    timeout(0);
+    int ch = getch();
+    if (ch != ERR) {
+        return ch;  // ncurses had it buffered already
+    }
+
+    int events = waitForEvents(idleTimeout(browser), browser.watcher.descriptor());
+    if (!(events & EVENT_INPUT)) {
+        auto sinceFrame = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                                lastFrame).count();
+        if (sinceFrame >= FRAME_MS || !waitForInput(FRAME_MS - (int)sinceFrame)) {
+            return ERR;
+        }
+    }
+    return getch();
+}
+
+// Function to unmark every entry
+void clearMarks(Browser &browser) {
+    if (browser.marked > 0) {
+        for (DirEntry &entry : browser.listing.entries) {
+            entry.flags &= ~ENTRY_MARKED;
+        }
+        browser.marked = 0;
+    }
+}
+
+// Function to mark or unmark the selected entry; "." and ".." can't be marked
+void toggleMark(Browser &browser) {
+    int selected = selectedIndex(browser);
+    if (selected < 0 || browser.results == RESULTS_GREP) {
+        return;
+    }
+    DirEntry &entry = browser.listing.entries[selected];
+    std::string_view name = browser.listing.nameView(entry);
+    if (name != "." && name != "..") {
+        entry.flags ^= ENTRY_MARKED;
+        browser.marked += (entry.flags & ENTRY_MARKED) ? 1 : -1;
+    }
+}
+
+// Function to stop everything going on for the current listing before it is
+// replaced, keeping it in the cache if it is a directory that was read completely
+void leaveListing(Browser &browser) {
+    applyDirectoryChanges(browser);
+    clearMarks(browser);
+    if (!browser.loader.busy() && browser.results == RESULTS_NONE) {
+        browser.cache.put(std::move(browser.listing), browser.choice, browser.topRow);
+    }
+    browser.loader.cancel();
+    browser.prefetcher.cancel();
+    browser.sizer.cancel();
+    browser.finder.cancel();
+    browser.grep.cancel();
+    browser.grepHits.clear();
+    browser.results = RESULTS_NONE;
+    browser.resultsPattern.clear();
+    browser.searchStopped = false;
+    browser.watchEvents.clear();
+    browser.pendingRestore = HistoryEntry();
+    browser.editingFilter = false;
+    browser.filterText.clear();
+    browser.view.filter.clear();
+}
+
+// Function to switch to a directory. Listings come from the cache or the
+// tree index when the directory hasn't changed, otherwise they are read in
+// the background; if restore is given its selection is put back either way.
+void openDirectory(Browser &browser, const std::string &path, const HistoryEntry *restore) {
+    leaveListing(browser);
+
+    browser.currentDir = path;
+    browser.choice = 0;
+    browser.topRow = 0;
+    if (!browser.index || !browser.index->covers(path)) {
+        browser.index = TreeIndex::find(path);
+    }
+    if (!browser.cache.take(path, browser.listing, browser.choice, browser.topRow)) {
+        if (browser.index && browser.index->list(path, browser.listing)) {
+            browser.loader.startMetadata(browser.listing);  // the index only has the names up to date
+        } else {
+            browser.listing = DirListing();
+            browser.listing.path = path;
+            browser.loader.start(path);
         }
     }
+    browser.view.clear();
+    resortView(browser);
+    browser.watcher.watch(path);
+    if (restore) {
+        browser.pendingRestore = *restore;
+    }
+}
+
+// Function to read ahead the directory or file Enter would open on the
+// selection, unless it would come from the cache or the tree index anyway.
+// Nothing is read ahead while the listing itself is still being read.
+void prefetchSelection(Browser &browser) {
+    const DirEntry *entry = entryAt(browser, browser.choice);
+    std::string_view name = entry ? browser.listing.nameView(*entry) : std::string_view();
+    if (!entry || browser.results == RESULTS_GREP || browser.loader.busy() || name == "." || name == ".." ||
+        (entry->type == ENTRY_DIR && browser.index)) {
+        browser.prefetcher.cancel();
+        return;
+    }
+    std::string path = browser.currentDir + "/" + std::string(name);
+    if (browser.cache.contains(path)) {
+        browser.prefetcher.cancel();
+        return;
+    }
+    browser.prefetcher.request(path);
+}
+
+// Function to put a remembered selection back once its entry has been read
+void restoreSelection(Browser &browser) {
+    HistoryEntry &restore = browser.pendingRestore;
+    if (restore.path.empty()) {
+        return;
+    }
+
+    int hint = entryAt(browser, restore.choice) ? (int)browser.view.order[restore.choice] : -1;
+    int found = viewPosition(browser.view, findEntry(browser.listing, restore.selected, hint));
+    if (found >= 0) {
+        // Same entry, same place on screen
+        browser.choice = found;
+        browser.topRow = std::max(0, found - (restore.choice - restore.topRow));
+        restore = HistoryEntry();
+    } else if (!browser.loader.busy()) {
+        restore = HistoryEntry();  // it's gone
+    }
+}
 
-    // Wait for user input to return to the directory view
-    erase();
-    mvprintw(0, 0, "Returning to directory view...");
+// Function to replace the listing with search results for the current
+// directory, to be filled in by the finder or the grep. The directory itself
+// goes on the back stack, so going back returns to it.
+void showResults(Browser &browser, ResultsKind kind, const std::string &pattern) {
+    if (browser.results == RESULTS_NONE) {
+        browser.forwardStack = std::stack<HistoryEntry>();
+        browser.backStack.push(currentPosition(browser));
+    }
+    leaveListing(browser);
+    browser.watcher.stop();
+
+    browser.listing = DirListing();
+    browser.listing.path = browser.currentDir;
+    browser.choice = 0;
+    browser.topRow = 0;
+    browser.results = kind;
+    browser.resultsPattern = pattern;
+    browser.view.clear();
+    resortView(browser);
+}
+
+// Function to list everything below the current directory whose name contains pattern
+void startFind(Browser &browser, const std::string &pattern) {
+    showResults(browser, RESULTS_FIND, pattern);
+    browser.finder.start(browser.currentDir, pattern, browser.index);
+}
+
+// Function to list the lines of the files below the current directory that
+// contain pattern, or match it as a regular expression
+void startGrep(Browser &browser, const std::string &pattern, bool regex) {
+    std::string error;
+    if (regex && !checkRegex(pattern, error)) {
+        browser.message = "Bad regular expression: " + error;
+        return;
+    }
+    showResults(browser, RESULTS_GREP, pattern);
+    browser.grep.start(browser.currentDir, pattern, regex);
+}
+
+// Function to show a file in the viewer, or hand it to the default
+// application if it can't be read; that runs alongside rather than blocking
+void openFile(Browser &browser, const std::string &path, uint64_t line) {
+    if (isReadable(path)) {
+        displayFileContent(path, line);
+        return;
+    }
+    std::string error;
+    browser.message = openWithDefaultApplication(path, error) ? "Opening with the default application..." : error;
+}
+
+// Function to stop a file operation before exiting and wait until it has:
+// a cancelled copy still removes the file it was halfway through, which
+// wouldn't happen if the process ended under it
+void finishFileOperationBeforeExit(Browser &browser) {
+    if (!browser.fileOp.active()) {
+        return;
+    }
+    browser.fileOp.cancel();
+    mvprintw(LINES - 1, 0, "Finishing the file operation before exiting...");
+    clrtoeol();
     refresh();
-    getch();  // Wait for user input before exiting
+    while (!browser.fileOp.finished()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PROGRESS_POLL_MS));
+    }
+}
+
+// Function to copy, move or delete the marked entries, or the selected one if
+// none are marked, after asking where to or whether to go ahead
+void startFileOperation(Browser &browser, FileOpKind kind) {
+    if (browser.fileOp.active()) {
+        browser.message = "Already busy with a file operation; ESC stops it";
+        return;
+    }
+    if (browser.results == RESULTS_GREP) {
+        browser.message = "Grep results are lines, not files";
+        return;
+    }
+
+    std::vector<std::string> names;
+    for (const DirEntry &entry : browser.listing.entries) {
+        if (entry.flags & ENTRY_MARKED) {
+            names.emplace_back(browser.listing.nameView(entry));
+        }
+    }
+    if (names.empty() && entryAt(browser, browser.choice)) {
+        std::string name = browser.listing.name(*entryAt(browser, browser.choice));
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    if (names.empty()) {
+        return;
+    }
+
+    char label[256];
+    const char *what = names.size() == 1 ? names[0].c_str() : nullptr;
+    std::string answer;
+    if (kind == FILE_OP_DELETE) {
+        if (what) {
+            snprintf(label, sizeof(label), "Delete %s? (y/n) ", what);
+        } else {
+            snprintf(label, sizeof(label), "Delete %zu entries? (y/n) ", names.size());
+        }
+        if (!promptLine(label, answer) || (answer != "y" && answer != "yes")) {
+            return;
+        }
+    } else {
+        const char *verb = kind == FILE_OP_COPY ? "Copy" : "Move";
+        if (what) {
+            snprintf(label, sizeof(label), "%s %s to: ", verb, what);
+        } else {
+            snprintf(label, sizeof(label), "%s %zu entries to: ", verb, names.size());
+        }
+        if (!promptLine(label, answer) || answer.empty()) {
+            return;
+        }
+        if (answer[0] != '/') {
+            answer = browser.currentDir + "/" + answer;  // relative to the directory shown
+        }
+    }
+    browser.fileOp.start(kind, browser.currentDir, names, answer);
+    clearMarks(browser);
+}
+
+// Function to report on the file operation once it is over. The watcher
+// brings the listing up to date with what it did.
+void finishFileOperation(Browser &browser) {
+    if (!browser.fileOp.finished()) {
+        return;
+    }
+    FileOpProgress progress = browser.fileOp.progress();
+    browser.fileOp.clear();
+
+    static const char *done[] = {"Copied", "Moved", "Deleted"};
+    char text[512];
+    int length;
+    if (progress.stopped) {
+        length = snprintf(text, sizeof(text), "Stopped %s after %llu of %llu entries", fileOpVerb(progress.kind),
+                          (unsigned long long)progress.filesDone, (unsigned long long)progress.filesTotal);
+    } else {
+        length = snprintf(text, sizeof(text), "%s %llu %s", done[progress.kind],
+                          (unsigned long long)progress.filesDone, progress.filesDone == 1 ? "entry" : "entries");
+    }
+    if (progress.errors > 0) {
+        snprintf(text + length, sizeof(text) - length, "; %llu failed, first: %s", (unsigned long long)progress.errors,
+                 progress.firstError.c_str());
+    }
+    browser.message = text;
+}
+
+// Function to start writing the tree index of the current directory
+void startIndexing(Browser &browser) {
+    if (browser.indexer.active()) {
+        browser.message = "Already indexing; ESC stops it";
+        return;
+    }
+    browser.indexer.start(browser.currentDir);
+}
+
+// Function to report on the indexer once it is done, and start using what it wrote
+void finishIndexing(Browser &browser) {
+    if (!browser.indexer.finished()) {
+        return;
+    }
+    bool succeeded = browser.indexer.succeeded();
+    size_t scanned = browser.indexer.scanned();
+    browser.indexer.clear();
+    browser.index = TreeIndex::find(browser.currentDir);
+    browser.message = succeeded ? "Indexed " + std::to_string(scanned) + " entries" : "Couldn't write the index";
+}
+
+// Function to go back to the previous directory in the history, if there is one
+bool goBack(Browser &browser) {
+    if (browser.backStack.empty()) {
+        return false;
+    }
+    HistoryEntry back = browser.backStack.top();
+    browser.backStack.pop();
+    if (browser.results == RESULTS_NONE) {
+        browser.forwardStack.push(currentPosition(browser)); // Push current directory to forward stack
+    }
+    openDirectory(browser, back.path, &back);
+    restoreSelection(browser);
+    return true;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    // --trace goes with either mode; options such as --list are for scripts,
+    // which get their output without the user interface
+    argc = takeTraceOption(argc, argv);
+    if (argc < 0) {
+        return 2;
+    }
+    if (argc > 1) {
+        return runBatch(argc, argv);
+    }
+
     // Initialize ncurses
     initscr();
     noecho();
     curs_set(0);
-    keypad(stdscr, TRUE);
-    // signal(SIG, handle_resize);
+    keypad(stdscr, TRUE);  // also makes resizes arrive as KEY_RESIZE
 
-    // Track navigation history for back/forward functionality
-    std::stack<std::string> backStack;
-    std::stack<std::string> forwardStack;
+    Browser browser;
+    DirListing &listing = browser.listing;
+    ListingView &view = browser.view;
+    int &choice = browser.choice;
+    int &topRow = browser.topRow;
 
     // Get current working directory
     char cwd[256];
     getcwd(cwd, sizeof(cwd));
-    std::string currentDir(cwd);
 
     // Get directory contents
-    std::vector<std::string> contents = getDirectoryContents(currentDir);
+    openDirectory(browser, cwd, nullptr);
 
     // Main loop
-    int choice = 0;
+    int drawnChoice = -1;     // What is currently on screen, for incremental redraws
+    int drawnTopRow = -1;
+    bool fullRedraw = true;
+    std::string previewed;    // previewPath() of the selection, worked out again when that may have changed
+    std::string drawnPreview; // path of the preview in the pane, "" when it is blank
+    int drawnPreviewRows = -1;
+    std::chrono::steady_clock::time_point lastFrame;
     while (true) {
-        // Clear screen
-        erase();
+        // Pick up whatever the loader found since the last pass, and news of
+        // an application started to open a file
+        std::string launchFailure = takeLaunchFailure();
+        if (!launchFailure.empty()) {
+            browser.message = launchFailure;
+        }
+        finishFileOperation(browser);
+        finishIndexing(browser);
+        if (browser.finder.drain(listing) || browser.grep.drain(listing, browser.grepHits)) {
+            extendView(view, listing);
+            drawnTopRow = -1;
+        }
+        if (browser.loader.drain(listing)) {
+            extendView(view, listing);
+            browser.viewStale = true;  // types, sizes and times came in too
+            restoreSelection(browser);
+            drawnTopRow = -1;  // repaint the viewport rows
+        }
+
+        bool previewTaken = browser.previewer.take(browser.preview);
+        DirListing prefetched;
+        if (browser.prefetcher.take(prefetched)) {
+            browser.cache.put(std::move(prefetched), 0, 0);
+        }
+
+        // ...and whatever changed in the directory since
+        if (applyDirectoryChanges(browser)) {
+            drawnTopRow = -1;
+        }
+        if (applyDirectorySizes(browser)) {
+            drawnTopRow = -1;
+        }
+        if (resortDue(browser)) {
+            resortView(browser);
+            drawnTopRow = -1;
+        }
+
+        int listRows = std::max(1, LINES - 2);  // Subtract 2 for directory name and status line
+        int lastIndex = std::max(0, (int)view.size() - 1);
+        choice = std::min(choice, lastIndex);
+
+        // Keep the selection inside the viewport
+        topRow = std::min(topRow, std::max(0, (int)view.size() - listRows));
+        if (choice < topRow) {
+            topRow = choice;
+        }
+        if (choice >= topRow + listRows) {
+            topRow = choice - listRows + 1;
+        }
 
-        /*if(is_term_resized()){
-            clear();
-        }*/
+        TraceTimer redrawTimer(TRACE_REDRAW);
+        if (fullRedraw || topRow != drawnTopRow) {
+            if (fullRedraw) {
+                // Clear screen
+                erase();
 
-        // Print directory path
-        mvprintw(0, 0, "Directory: %s", currentDir.c_str());
+                // Print directory path
+                if (browser.results == RESULTS_NONE) {
+                    mvprintw(0, 0, "Directory: %s", browser.currentDir.c_str());
+                } else {
+                    mvprintw(0, 0, "%s \"%s\" below %s", browser.results == RESULTS_FIND ? "Find" : "Grep",
+                             browser.resultsPattern.c_str(), browser.currentDir.c_str());
+                }
+            }
 
-        // Print directory contents
-        for (int i = 0; i < contents.size(); i++) {
-            if (i == choice) {
-                attron(A_REVERSE);
+            // Print the visible part of the directory contents
+            for (int i = topRow; i < topRow + listRows; i++) {
+                drawListingRow(browser, i, i == choice);
             }
-            mvprintw(i + 1, 0, "%s", contents[i].c_str());
-            if (i == choice) {
-                attroff(A_REVERSE);
+        } else if (choice != drawnChoice) {
+            // Only the highlight moved
+            drawListingRow(browser, drawnChoice, false);
+            drawListingRow(browser, choice, true);
+        }
+        if (browser.showPreview && (fullRedraw || previewTaken || topRow != drawnTopRow || choice != drawnChoice ||
+                                    listRows != drawnPreviewRows)) {
+            // Repaint the pane only if what it shows or its size changed
+            previewed = previewPath(browser);
+            bool current = browser.preview.path == previewed;
+            std::string shown = current ? previewed : std::string();
+            if (fullRedraw || shown != drawnPreview || (previewTaken && current) || listRows != drawnPreviewRows) {
+                drawPreview(browser, listRows, current);
             }
+            drawnPreview = shown;
+            drawnPreviewRows = listRows;
+        }
+        if (browser.showTrace) {
+            drawTraceOverlay();
         }
+        drawListingStatus(browser);
+        refresh();
+        redrawTimer.finish();
+        drawnChoice = choice;
+        drawnTopRow = topRow;
+        fullRedraw = false;
 
-        // Handle user input
-        int ch = getch();
+        // Handle user input, waking up regularly to pick up loader results and changes
+        int visibleEnd = std::min((int)view.size(), topRow + listRows);
+        curs_set(browser.editingFilter ? 1 : 0);
+        browser.loader.setVisible(std::vector<uint32_t>(view.order.begin() + std::min(topRow, visibleEnd),
+                                                        view.order.begin() + visibleEnd));
+        prefetchSelection(browser);
+        if (browser.showPreview) {
+            if (previewed.empty()) {
+                browser.previewer.cancel();
+            } else {
+                browser.previewer.request(previewed);
+            }
+        }
+        lastFrame = std::chrono::steady_clock::now();
+        int ch = waitForKey(browser, lastFrame);
+        if (ch == ERR) {
+            continue;
+        }
+        browser.message.clear();
+        if (browser.editingFilter && editFilter(browser, ch)) {
+            drawnTopRow = -1;
+            continue;
+        }
         switch (ch) {
         case KEY_UP:
             choice = std::max(0, choice - 1);
             break;
         case KEY_DOWN:
-            choice = std::min((int)contents.size() - 1, choice + 1);
+            choice = std::min(lastIndex, choice + 1);
+            break;
+        case KEY_PPAGE:
+            choice = std::max(0, choice - listRows);
+            break;
+        case KEY_NPAGE:
+            choice = std::min(lastIndex, choice + listRows);
+            break;
+        case KEY_HOME:
+            choice = 0;
+            break;
+        case KEY_END:
+            choice = lastIndex;
+            break;
+        case KEY_RESIZE:
+            fullRedraw = true;
+            break;
+        case ' ':
+        case KEY_IC:
+            // Mark or unmark the selection for a file operation, and move on
+            toggleMark(browser);
+            drawnTopRow = -1;
+            choice = std::min(lastIndex, choice + 1);
+            break;
+        case 'c':
+            startFileOperation(browser, FILE_OP_COPY);
+            fullRedraw = true;
+            break;
+        case 'm':
+            startFileOperation(browser, FILE_OP_MOVE);
+            fullRedraw = true;
+            break;
+        case 'd':
+            startFileOperation(browser, FILE_OP_DELETE);
+            fullRedraw = true;
+            break;
+        case 'I':
+            // Index the tree below the current directory, to find and size it from
+            startIndexing(browser);
+            break;
+        case 'T':
+#ifdef HAVE_TRACE
+            browser.showTrace = !browser.showTrace;
+            fullRedraw = true;  // the listing rows under the overlay
+#else
+            browser.message = "This build has no tracing; use a Debug build";
+#endif
+            break;
+        case 'p':
+            // Show or hide the preview pane
+            browser.showPreview = !browser.showPreview;
+            if (!browser.showPreview) {
+                browser.previewer.cancel();
+            }
+            fullRedraw = true;
+            break;
+        case 's':
+            // Recursive size of the selected directory
+            startSizing(browser, false);
+            break;
+        case 'S':
+            // Recursive sizes of all directories here
+            startSizing(browser, true);
+            break;
+        case 'o':
+            // Next sort order
+            view.mode = (SortMode)((view.mode + 1) % SORT_MODE_COUNT);
+            resortView(browser);
+            drawnTopRow = -1;
+            break;
+        case 'O':
+            // Reverse the sort order
+            view.descending = !view.descending;
+            resortView(browser);
+            drawnTopRow = -1;
             break;
         case 10: {
             // Enter key to enter a directory or view file content
-            std::string selected = contents[choice].substr(contents[choice].find_last_of(" ") + 1);
-            std::string selectedPath = currentDir + "/" + selected;
+            if (!entryAt(browser, choice)) {
+                break;
+            }
+            std::string selected = listing.name(*entryAt(browser, choice));
+            if (browser.results == RESULTS_GREP) {
+                // Open the file at the line of the hit
+                const GrepHit &hit = browser.grepHits[view.order[choice]];
+                openFile(browser, browser.currentDir + "/" + selected.substr(0, hit.pathLength), hit.line);
+                fullRedraw = true;
+                break;
+            }
+            std::string selectedPath = browser.currentDir + "/" + selected;
 
             struct stat fileStat;
             if (stat(selectedPath.c_str(), &fileStat) == 0) {
                 if (S_ISDIR(fileStat.st_mode)) {
                     // Enter selected directory
+                    std::string target = selectedPath;
                     if (selected == "..") {
                         // Go to parent directory
-                        size_t lastSlash = currentDir.find_last_of('/');
-                        if (lastSlash != std::string::npos) {
-                            forwardStack = std::stack<std::string>();  // Clear forward stack
-                            backStack.push(currentDir); // Push current directory to back stack
-                            currentDir = currentDir.substr(0, lastSlash);
-                        }
-                    } else {
-                        forwardStack = std::stack<std::string>();  // Clear forward stack
-                        backStack.push(currentDir); // Push current directory to back stack
-                        currentDir = selectedPath;
+                        size_t lastSlash = browser.currentDir.find_last_of('/');
+                        target = lastSlash == std::string::npos ? "" : lastSlash == 0 ? "/" : browser.currentDir.substr(0, lastSlash);
+                    }
+                    if (!target.empty()) {
+                        browser.forwardStack = std::stack<HistoryEntry>();  // Clear forward stack
+                        browser.backStack.push(currentPosition(browser)); // Push current directory to back stack
+                        openDirectory(browser, target, nullptr);
                     }
-                    contents = getDirectoryContents(currentDir);
-                    choice = 0;
                 } else if (S_ISREG(fileStat.st_mode)) {
                     // If it's a regular file, display its content
-                    displayFileContent(selectedPath);
+                    openFile(browser, selectedPath, 0);
                 }
+                fullRedraw = true;
             }
             break;
         }
         case KEY_LEFT:
             // Navigate back in history
-            if (!backStack.empty()) {
-                forwardStack.push(currentDir); // Push current directory to forward stack
-                currentDir = backStack.top();
-                backStack.pop();
-                contents = getDirectoryContents(currentDir);
-                choice = 0;
+            if (goBack(browser)) {
+                fullRedraw = true;
             }
             break;
         case KEY_RIGHT:
             // Navigate forward in history
-            if (!forwardStack.empty()) {
-                backStack.push(currentDir); // Push current directory to back stack
-                currentDir = forwardStack.top();
-                forwardStack.pop();
-                contents = getDirectoryContents(currentDir);
-                choice = 0;
+            if (!browser.forwardStack.empty()) {
+                HistoryEntry forward = browser.forwardStack.top();
+                browser.forwardStack.pop();
+                browser.backStack.push(currentPosition(browser)); // Push current directory to back stack
+                openDirectory(browser, forward.path, &forward);
+                restoreSelection(browser);
+                fullRedraw = true;
+            }
+            break;
+        case '/':
+            // Narrow the listing down as a filter is typed
+            browser.editingFilter = true;
+            break;
+        case 'f': {
+            // Find by name below the current directory
+            std::string pattern;
+            if (promptLine("Find: ", pattern) && !pattern.empty()) {
+                startFind(browser, pattern);
             }
+            fullRedraw = true;
             break;
+        }
+        case 'g':
+        case 'G': {
+            // Search file contents below the current directory, for a string or a regular expression
+            std::string pattern;
+            if (promptLine(ch == 'g' ? "Grep: " : "Grep for regex: ", pattern) && !pattern.empty()) {
+                startGrep(browser, pattern, ch == 'G');
+            }
+            fullRedraw = true;
+            break;
+        }
         case 27: // Escape key
+            if (!browser.filterText.empty()) {
+                changeFilter(browser, "");  // first drop the filter
+                drawnTopRow = -1;
+                break;
+            }
+            if (browser.finder.busy() || browser.grep.busy()) {
+                browser.finder.cancel();  // stop searching, keep what was found
+                browser.grep.cancel();
+                browser.searchStopped = true;
+                break;
+            }
+            if (browser.indexer.active()) {
+                browser.indexer.cancel();
+                browser.message = "Indexing stopped";
+                break;
+            }
+            if (browser.fileOp.active() && !browser.fileOp.progress().cancelled) {
+                browser.fileOp.cancel();  // its message says how far it got
+                break;
+            }
+            if (browser.marked > 0) {
+                clearMarks(browser);
+                drawnTopRow = -1;
+                break;
+            }
+            if (browser.results != RESULTS_NONE) {
+                goBack(browser);  // leave the results
+                fullRedraw = true;
+                break;
+            }
             goto exit;
         }
+
+        // Moving the selection by hand wins over a pending restore
+        if (ch == KEY_UP || ch == KEY_DOWN || ch == KEY_PPAGE || ch == KEY_NPAGE || ch == KEY_HOME || ch == KEY_END) {
+            browser.pendingRestore = HistoryEntry();
+        }
     }
 
 exit:
     // Clean up
+    finishFileOperationBeforeExit(browser);
     endwin();
     return 0;
 }
@@ -0,0 +1,379 @@
+#include "metadata.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "trace.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// IORING_OP_STATX is an enum value; headers of 5.6 and later, which have
+// it, are the ones that define IORING_FEAT_CUR_PERSONALITY
+#if defined(__linux__) && defined(IORING_FEAT_CUR_PERSONALITY) && defined(STATX_TYPE) && defined(__NR_io_uring_setup)
+#define HAVE_STAT_RING
+#endif
+
+// Requests in flight at once on the io_uring: on a mount where each stat is
+// a round trip, roughly how many times faster a batch goes than one stat
+// after another
+static const unsigned STAT_QUEUE_DEPTH = 64;
+
+// Threads that share a batch where io_uring can't be used
+static const unsigned STAT_POOL_THREADS = 8;
+
+// Batches smaller than this are stat'ed one after another on the calling thread
+static const size_t MIN_PARALLEL_STATS = 4;
+
+// Stats timed before deciding whether to batch, and the average time from
+// which they are: a round trip to a file server rather than the inode cache
+static const uint64_t PROBE_STATS = 8;
+static const uint64_t SLOW_STAT_NS = 100000;
+
+#ifdef HAVE_STAT_RING
+
+// Only what the listing shows
+static const unsigned STATX_SHOWN = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+
+// An io_uring set up with the raw system calls, its rings mapped
+struct StatRing {
+    int fd = -1;
+    void *sqMap = MAP_FAILED;
+    size_t sqMapSize = 0;
+    void *cqMap = MAP_FAILED;  // the same as sqMap on kernels that map both rings at once
+    size_t cqMapSize = 0;
+    io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+    size_t sqesSize = 0;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+    unsigned depth = 0;
+    std::vector<struct statx> results;  // one per entry of the batch being fetched
+
+    ~StatRing();
+    bool open(unsigned entries);
+};
+
+// Set once io_uring turned out not to work here, so later fetchers don't try again
+static std::atomic<bool> ringUnavailable{false};
+
+StatRing::~StatRing() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqMap != MAP_FAILED && cqMap != sqMap) {
+        munmap(cqMap, cqMapSize);
+    }
+    if (sqMap != MAP_FAILED) {
+        munmap(sqMap, sqMapSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool StatRing::open(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return false;  // ENOSYS, or EPERM where it is switched off
+    }
+    depth = params.sq_entries;
+
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+    }
+    sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        return false;
+    }
+    cqMap = singleMap ? sqMap
+                      : mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqMap == MAP_FAILED) {
+        return false;
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+
+    char *sq = (char *)sqMap;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+    char *cq = (char *)cqMap;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Stat the entries through the ring, keeping up to its depth in flight.
+// Returns false if the kernel can't do statx() on an io_uring; the entries
+// it didn't do are left without ENTRY_HAS_STAT then.
+static bool fetchWithRing(StatRing &ring, DirListing &listing, const std::vector<uint32_t> &indices) {
+    size_t count = indices.size();
+    ring.results.resize(count);
+    int dirFd = dirfd(listing.dir.get());
+#ifdef HAVE_TRACE
+    std::vector<std::chrono::steady_clock::time_point> submitted(count);
+#endif
+
+    size_t queued = 0;        // sqes filled in
+    size_t completed = 0;
+    unsigned inFlight = 0;    // queued and not completed
+    unsigned unsubmitted = 0; // queued but not yet taken by the kernel
+    bool supported = true;
+    bool broken = false;      // io_uring_enter() failed; only collect what is in flight
+    while (completed < queued || (queued < count && !broken)) {
+        unsigned tail = *ring.sqTail;
+        while (queued < count && inFlight < ring.depth && !broken) {
+            unsigned slot = tail & *ring.sqMask;
+            io_uring_sqe &sqe = ring.sqes[slot];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = dirFd;
+            sqe.addr = (uint64_t)(uintptr_t)listing.name(listing.entries[indices[queued]]);
+            sqe.len = STATX_SHOWN;
+            sqe.off = (uint64_t)(uintptr_t)&ring.results[queued];
+            sqe.statx_flags = 0;  // follow links, as fillMetadata() does
+            sqe.user_data = queued;
+            ring.sqArray[slot] = slot;
+#ifdef HAVE_TRACE
+            submitted[queued] = std::chrono::steady_clock::now();
+#endif
+            tail++;
+            queued++;
+            inFlight++;
+            unsubmitted++;
+        }
+        __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+
+        long taken = syscall(__NR_io_uring_enter, ring.fd, broken ? 0 : unsubmitted, 1, IORING_ENTER_GETEVENTS,
+                             NULL, 0);
+        if (taken >= 0) {
+            unsubmitted -= std::min<unsigned>(unsubmitted, (unsigned)taken);
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // Anything the kernel took may still write its result; wait for
+            // those, and leave what it didn't take to the fallback
+            broken = true;
+            supported = false;
+            inFlight -= unsubmitted;
+            queued -= unsubmitted;
+            unsubmitted = 0;
+            if (inFlight == 0) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+
+        unsigned head = *ring.cqHead;
+        unsigned ready = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != ready; head++) {
+            const io_uring_cqe &cqe = ring.cqes[head & *ring.cqMask];
+            size_t i = (size_t)cqe.user_data;
+            DirEntry &entry = listing.entries[indices[i]];
+            if (cqe.res == -EINVAL) {
+                supported = false;  // kernels before 5.6 have no IORING_OP_STATX
+            } else {
+                entry.flags |= ENTRY_HAS_STAT;
+                if (cqe.res == 0) {
+                    const struct statx &st = ring.results[i];
+                    entry.type = typeFromMode(st.stx_mode);
+                    entry.mode = st.stx_mode;
+                    entry.size = (int64_t)st.stx_size;
+                    entry.mtime = st.stx_mtime.tv_sec;
+                    entry.flags |= ENTRY_STAT_OK;
+                }
+            }
+#ifdef HAVE_TRACE
+            traceAdd(TRACE_STAT, 1,
+                     (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - submitted[i]).count(), std::string_view());
+#endif
+            inFlight--;
+            completed++;
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+    return supported;
+}
+
+#else
+
+struct StatRing {};
+
+#endif
+
+#ifndef _WIN32
+
+// Worker threads that stat the entries of a batch between them. Workers
+// only pick up a batch while fetch() is waiting on it, so once it returns
+// none of them holds on to the listing.
+struct StatPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    DirListing *listing = nullptr;                // the batch being worked on, or null
+    const std::vector<uint32_t> *indices = nullptr;
+    std::atomic<size_t> next{0};
+    unsigned generation = 0;  // bumped for every batch
+    unsigned working = 0;     // workers on the current batch
+    bool stopping = false;
+
+    ~StatPool();
+};
+
+// Stat entries of the current batch until there are none left
+static void statShare(StatPool &pool, DirListing &listing, const std::vector<uint32_t> &indices) {
+    PathBuffer path;
+    for (size_t i; (i = pool.next++) < indices.size();) {
+        statListed(listing, listing.entries[indices[i]], path);
+    }
+}
+
+static void poolWorker(StatPool &pool) {
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (true) {
+        pool.wake.wait(lock, [&] { return pool.stopping || (pool.listing && pool.generation != seen); });
+        if (pool.stopping) {
+            return;
+        }
+        seen = pool.generation;
+        DirListing &listing = *pool.listing;
+        const std::vector<uint32_t> &indices = *pool.indices;
+        pool.working++;
+        lock.unlock();
+        statShare(pool, listing, indices);
+        lock.lock();
+        if (--pool.working == 0) {
+            pool.done.notify_all();
+        }
+    }
+}
+
+StatPool::~StatPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+static void fetchWithPool(StatPool &pool, DirListing &listing, const std::vector<uint32_t> &indices) {
+    if (pool.threads.empty()) {
+        for (unsigned i = 1; i < STAT_POOL_THREADS; i++) {
+            pool.threads.emplace_back(poolWorker, std::ref(pool));
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.listing = &listing;
+        pool.indices = &indices;
+        pool.next = 0;
+        pool.generation++;
+    }
+    pool.wake.notify_all();
+    statShare(pool, listing, indices);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.done.wait(lock, [&] { return pool.working == 0; });
+    pool.listing = nullptr;
+    pool.indices = nullptr;
+}
+
+#else
+
+struct StatPool {};
+
+#endif
+
+MetadataFetcher::MetadataFetcher() {}
+
+MetadataFetcher::~MetadataFetcher() {}
+
+void MetadataFetcher::fetch(DirListing &listing, const std::vector<uint32_t> &indices) {
+    std::vector<uint32_t> pending;
+    pending.reserve(indices.size());
+    for (uint32_t i : indices) {
+        if (i < listing.entries.size() && !(listing.entries[i].flags & ENTRY_HAS_STAT)) {
+            pending.push_back(i);
+        }
+    }
+    TraceTimer timer(TRACE_METADATA, listing.path);
+    timer.setItems(pending.size());
+
+    PathBuffer path;
+    size_t probed = 0;
+    while (!batched && probedStats < PROBE_STATS && probed < pending.size()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        statListed(listing, listing.entries[pending[probed++]], path);
+        probedNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (++probedStats == PROBE_STATS) {
+            batched = probedNs / PROBE_STATS >= SLOW_STAT_NS;
+        }
+    }
+    pending.erase(pending.begin(), pending.begin() + probed);
+
+#ifndef _WIN32
+    if (batched && pending.size() >= MIN_PARALLEL_STATS && listing.dir) {
+#ifdef HAVE_STAT_RING
+        if (!ring && !ringUnavailable) {
+            ring.reset(new StatRing);
+            if (!ring->open(STAT_QUEUE_DEPTH)) {
+                ring.reset();
+                ringUnavailable = true;
+            }
+        }
+        if (ring) {
+            if (fetchWithRing(*ring, listing, pending)) {
+                return;
+            }
+            ring.reset();
+            ringUnavailable = true;
+            // The pool does whatever the ring couldn't
+            pending.erase(std::remove_if(pending.begin(), pending.end(), [&](uint32_t i) {
+                return (listing.entries[i].flags & ENTRY_HAS_STAT) != 0;
+            }), pending.end());
+        }
+#endif
+        if (!pool) {
+            pool.reset(new StatPool);
+        }
+        fetchWithPool(*pool, listing, pending);
+        return;
+    }
+#endif
+    for (uint32_t i : pending) {
+        statListed(listing, listing.entries[i], path);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef METADATA_H_INCLUDED
+#define METADATA_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "listing.h"
+
+struct StatRing;
+struct StatPool;
+
+// Stats many entries of a listing at once, so that on a mount where every
+// stat is a network round trip a batch costs about one round trip rather
+// than one per entry. On Linux the whole batch is submitted as statx()
+// requests through io_uring, asking only for the type, mode, size and mtime
+// that are shown; where io_uring isn't there (old kernels, sandboxes that
+// block it, other systems) a few threads share the batch with fstatat().
+// Entries come out as fillMetadata() leaves them. Use from one thread, and
+// for one directory: the first few stats are timed, and batches are only
+// used if they are slow, since on a local disk stats come from the inode
+// cache in a microsecond and batching them only adds overhead.
+class MetadataFetcher {
+public:
+    MetadataFetcher();
+    ~MetadataFetcher();
+
+    // Fetch the metadata of listing.entries[i] for each i in indices
+    void fetch(DirListing &listing, const std::vector<uint32_t> &indices);
+
+private:
+    uint64_t probedStats = 0;  // stats timed so far, and how long they took
+    uint64_t probedNs = 0;
+    bool batched = false;      // they were slow enough to batch the rest
+    std::unique_ptr<StatRing> ring;  // null until needed, or if io_uring can't be used
+    std::unique_ptr<StatPool> pool;
+};
+
+#endif // METADATA_H_INCLUDED
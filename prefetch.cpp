@@ -0,0 +1,146 @@
+#include "prefetch.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#include "events.h"
+#include "metadata.h"
+#include "viewer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// How long the selection has to stay on an entry before it is read ahead
+static const int PREFETCH_DELAY_MS = 150;
+
+// Entries stat'ed at once by the MetadataFetcher
+static const size_t STAT_BATCH = 64;
+
+// State shared between a Prefetcher and its worker thread, which owns it
+// jointly so a cancelled job can finish on its own time
+struct PrefetchJob {
+    std::string path;
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;  // protects everything below
+    std::condition_variable wake;  // signalled on cancel, to end the delay early
+    DirListing listing;
+    bool ready = false;  // listing is complete and hasn't been taken
+};
+
+// Make the calling thread yield to everything else, for the CPU and, on
+// Linux, the disk
+static void lowerThreadPriority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+    // Linux applies nice values and I/O priorities per thread
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, (id_t)tid, 19);
+#ifdef SYS_ioprio_set
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+#endif
+}
+
+// Worker thread body
+static void prefetch(std::shared_ptr<PrefetchJob> job) {
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        if (job->wake.wait_for(lock, std::chrono::milliseconds(PREFETCH_DELAY_MS),
+                               [&] { return job->cancelled.load(); })) {
+            return;  // the selection moved on first
+        }
+    }
+    lowerThreadPriority();
+
+    struct stat pathStat;
+    if (stat(job->path.c_str(), &pathStat) != 0) {
+        return;
+    }
+    if (S_ISREG(pathStat.st_mode)) {
+        prefetchFile(job->path);
+        return;
+    }
+    if (!S_ISDIR(pathStat.st_mode)) {
+        return;
+    }
+
+    bool tooBig = false;
+    DirListing local = getDirectoryContents(job->path, [&](const DirListing &listing) {
+        tooBig = listingBytes(listing) > PREFETCH_LISTING_BYTES;
+        return !tooBig && !job->cancelled;
+    });
+    if (tooBig || !local.readable) {
+        return;
+    }
+
+    MetadataFetcher fetcher;
+    std::vector<uint32_t> toStat;
+    for (size_t next = 0; next < local.entries.size() && !job->cancelled;) {
+        toStat.clear();
+        for (; next < local.entries.size() && toStat.size() < STAT_BATCH; next++) {
+            if (!(local.entries[next].flags & ENTRY_HAS_STAT)) {
+                toStat.push_back((uint32_t)next);
+            }
+        }
+        fetcher.fetch(local, toStat);
+    }
+    if (job->cancelled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->listing = std::move(local);
+    job->ready = true;
+    wakeUi();
+}
+
+Prefetcher::~Prefetcher() {
+    cancel();
+}
+
+void Prefetcher::request(const std::string &path) {
+    if (job && job->path == path) {
+        return;
+    }
+    cancel();
+    job = std::make_shared<PrefetchJob>();
+    job->path = path;
+    std::thread(prefetch, job).detach();
+}
+
+void Prefetcher::cancel() {
+    if (job) {
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->cancelled = true;
+        }
+        job->wake.notify_all();
+        job.reset();
+    }
+}
+
+bool Prefetcher::take(DirListing &listing) {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (!job->ready) {
+        return false;
+    }
+    listing = std::move(job->listing);
+    job->ready = false;
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef PREFETCH_H_INCLUDED
+#define PREFETCH_H_INCLUDED
+
+#include <memory>
+#include <string>
+
+#include "listing.h"
+
+// Listings larger than this are not read ahead: they would crowd the
+// directory cache, and reading them is slow anyway
+const size_t PREFETCH_LISTING_BYTES = 4u << 20;
+
+struct PrefetchJob;
+
+// Reads ahead, on a low priority thread, what Enter on the selected entry
+// would read: a directory's listing with its metadata, or the first page of
+// a file and its line index side cache. Nothing starts until the selection
+// has stayed put for a moment, and moving it on cancels the work, so
+// scrolling through a listing costs nothing. Files are only brought into the
+// OS cache; directory listings are handed to the UI with take().
+class Prefetcher {
+public:
+    ~Prefetcher();
+
+    // Read ahead path, cancelling whatever was being read for another one. A
+    // request for the path already being read ahead is left running.
+    void request(const std::string &path);
+
+    // Stop reading ahead; the thread exits at its next batch of entries
+    void cancel();
+
+    // Move a directory listing read ahead, complete with metadata, into
+    // listing. Returns false if there is none (yet).
+    bool take(DirListing &listing);
+
+private:
+    std::shared_ptr<PrefetchJob> job;
+};
+
+#endif // PREFETCH_H_INCLUDED
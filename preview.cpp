@@ -0,0 +1,206 @@
+#include "preview.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+
+#include "compressed.h"
+#include "events.h"
+#include "listing.h"
+#include "scan.h"
+#include "view.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// How long a selection has to stay put before it is previewed, so that
+// holding a key down doesn't start a read for every entry passed
+static const int PREVIEW_DELAY_MS = 50;
+
+// Lines kept of a preview: more than any screen is high
+static const size_t PREVIEW_LINES = 256;
+
+// State shared between a Previewer and its worker thread, which owns it
+// jointly so a dropped preview can finish on its own time
+struct PreviewJob {
+    std::string path;
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;  // protects everything below
+    std::condition_variable wake;  // signalled on cancel, to end the delay early
+    Preview preview;
+    bool ready = false;  // preview is made and hasn't been taken
+};
+
+// Read up to PREVIEW_BYTES from the start of a file into data
+static bool readStart(const std::string &path, std::string &data) {
+    data.resize(PREVIEW_BYTES);
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD got = 0;
+    bool ok = ReadFile(file, &data[0], (DWORD)data.size(), &got, nullptr) != 0;
+    CloseHandle(file);
+    data.resize(ok ? got : 0);
+    return ok;
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);  // no waiting on a FIFO swapped in
+    if (fd < 0) {
+        return false;
+    }
+    size_t got = 0;
+    while (got < data.size()) {
+        ssize_t n = pread(fd, &data[got], data.size() - got, (off_t)got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(fd);
+    data.resize(got);
+    return true;
+#endif
+}
+
+// The first lines of a file, or what kind of file it is if it isn't text
+static void previewFile(const std::string &path, std::vector<std::string> &lines) {
+    std::string data;
+    if (!readStart(path, data)) {
+        lines.push_back("(can't be read)");
+        return;
+    }
+    Compression format = detectCompression(data.data(), data.size());
+    if (format != COMPRESSION_NONE) {
+        lines.push_back(std::string(compressionName(format)) + " compressed; Enter shows the text");
+        return;
+    }
+    if (looksBinary(data.data(), data.size())) {
+        lines.push_back("Binary; Enter shows a hex dump");
+        return;
+    }
+
+    size_t start = 0;
+    while (start < data.size() && lines.size() < PREVIEW_LINES) {
+        size_t end = data.find('\n', start);
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+        size_t length = end - start;
+        if (length > 0 && data[end - 1] == '\r') {
+            length--;
+        }
+        lines.push_back(data.substr(start, length));
+        start = end + 1;
+    }
+}
+
+// The names in a directory, sorted as in the listing, directories marked
+// with a slash. Only its first batch of entries is read.
+static void previewDirectory(const std::string &path, std::vector<std::string> &lines) {
+    DirListing listing = getDirectoryContents(path, [](const DirListing &) { return false; });
+    if (!listing.readable) {
+        lines.push_back("(can't be read)");
+        return;
+    }
+    ListingView view;
+    sortView(view, listing);
+    for (uint32_t index : view.order) {
+        const DirEntry &entry = listing.entries[index];
+        std::string_view name = listing.nameView(entry);
+        if (name == "." || name == "..") {
+            continue;
+        }
+        if (lines.size() == PREVIEW_LINES) {
+            break;
+        }
+        lines.emplace_back(name);
+        if (listing.isDir(entry)) {
+            lines.back().push_back('/');
+        }
+    }
+    if (lines.empty()) {
+        lines.push_back("(empty)");
+    }
+}
+
+// Worker thread body
+static void makePreview(std::shared_ptr<PreviewJob> job) {
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        if (job->wake.wait_for(lock, std::chrono::milliseconds(PREVIEW_DELAY_MS),
+                               [&] { return job->cancelled.load(); })) {
+            return;  // the selection moved on first
+        }
+    }
+
+    Preview preview;
+    preview.path = job->path;
+    struct stat pathStat;
+    if (stat(job->path.c_str(), &pathStat) != 0) {
+        preview.lines.push_back("(can't be read)");
+    } else if (S_ISDIR(pathStat.st_mode)) {
+        previewDirectory(job->path, preview.lines);
+    } else if (S_ISREG(pathStat.st_mode)) {
+        previewFile(job->path, preview.lines);
+    }
+    if (job->cancelled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->preview = std::move(preview);
+    job->ready = true;
+    wakeUi();
+}
+
+Previewer::~Previewer() {
+    cancel();
+}
+
+void Previewer::request(const std::string &path) {
+    if (job && job->path == path) {
+        return;
+    }
+    cancel();
+    job = std::make_shared<PreviewJob>();
+    job->path = path;
+    std::thread(makePreview, job).detach();
+}
+
+void Previewer::cancel() {
+    if (job) {
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->cancelled = true;
+        }
+        job->wake.notify_all();
+        job.reset();
+    }
+}
+
+bool Previewer::take(Preview &preview) {
+    if (!job) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (!job->ready) {
+        return false;
+    }
+    preview = std::move(job->preview);
+    job->ready = false;
+    return true;
+}
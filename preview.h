@@ -0,0 +1,45 @@
+#ifndef PREVIEW_H_INCLUDED
+#define PREVIEW_H_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// How much of the start of a file is read for its preview
+const size_t PREVIEW_BYTES = 64u << 10;
+
+// What the preview pane shows for one path: the first lines of a file, the
+// names in a directory, or a note saying why there is neither
+struct Preview {
+    std::string path;
+    std::vector<std::string> lines;
+};
+
+struct PreviewJob;
+
+// Makes previews on a worker thread, so the UI never waits for a disk: a
+// file's first PREVIEW_BYTES are read with one pread, however big it is, and
+// a directory's first batch of entries is read and sorted. Asking for
+// another path drops whatever was being made for the last one, so holding
+// Down through a long listing only ever previews where it stops.
+class Previewer {
+public:
+    ~Previewer();
+
+    // Start previewing path, dropping the preview still being made of another
+    // one. Asking again for the path being previewed does nothing.
+    void request(const std::string &path);
+
+    // Drop the preview being made; its thread exits without reading further
+    void cancel();
+
+    // Move a preview that has been made since the last call into preview.
+    // Returns false if there is none.
+    bool take(Preview &preview);
+
+private:
+    std::shared_ptr<PreviewJob> job;
+};
+
+#endif // PREVIEW_H_INCLUDED
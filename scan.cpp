@@ -0,0 +1,159 @@
+#include "scan.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SCAN_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Portable version: one memchr per newline, which is fine for long lines
+static const char *findNthNewlineScalar(const char *p, const char *end, uint64_t k, uint64_t *found) {
+    uint64_t seen = 0;
+    while (p < end) {
+        const char *newline = (const char *)memchr(p, '\n', end - p);
+        if (!newline) {
+            break;
+        }
+        if (++seen == k) {
+            *found = seen;
+            return newline;
+        }
+        p = newline + 1;
+    }
+    *found = seen;
+    return nullptr;
+}
+
+#ifdef SCAN_HAVE_AVX2
+// Compare 64 bytes at a time and count newlines with popcount, so short lines
+// cost no more to skip over than long ones
+__attribute__((target("avx2,popcnt")))
+static const char *findNthNewlineAvx2(const char *p, const char *end, uint64_t k, uint64_t *found) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    uint64_t seen = 0;
+
+    while (end - p >= 64) {
+        __m256i low = _mm256_loadu_si256((const __m256i *)p);
+        __m256i high = _mm256_loadu_si256((const __m256i *)(p + 32));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline)) |
+                        ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)) << 32);
+        uint64_t count = (uint64_t)__builtin_popcountll(mask);
+        if (seen + count >= k) {
+            // The k-th newline is in this block: clear the lower set bits
+            for (uint64_t i = seen + 1; i < k; i++) {
+                mask &= mask - 1;
+            }
+            *found = k;
+            return p + __builtin_ctzll(mask);
+        }
+        seen += count;
+        p += 64;
+    }
+
+    uint64_t tailFound;
+    const char *result = findNthNewlineScalar(p, end, k - seen, &tailFound);
+    *found = seen + tailFound;
+    return result;
+}
+#endif
+
+const char *findNthNewline(const char *begin, const char *end, uint64_t k, uint64_t *found) {
+#ifdef SCAN_HAVE_AVX2
+    static const bool haveAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (haveAvx2) {
+        return findNthNewlineAvx2(begin, end, k, found);
+    }
+#endif
+    return findNthNewlineScalar(begin, end, k, found);
+}
+
+static char foldCase(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static bool equalFolded(const char *text, const char *needle, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (foldCase(text[i]) != needle[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool containsFolded(const char *text, size_t length, size_t readable, std::string_view needle) {
+    size_t n = needle.size();
+    if (n == 0) {
+        return true;
+    }
+    if (n > length) {
+        return false;
+    }
+    size_t lastStart = length - n;
+    size_t i = 0;
+
+#ifdef SCAN_HAVE_SSE2
+    // Find the positions where both the first and the last byte of the needle
+    // match, 16 at a time, and only compare the rest there. ORing in 0x20 folds
+    // the case of letters; it is only done to bytes compared against a letter.
+    auto isLetter = [](char c) { return c >= 'a' && c <= 'z'; };
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    const __m128i foldFirst = _mm_set1_epi8(isLetter(needle[0]) ? 0x20 : 0);
+    const __m128i foldLast = _mm_set1_epi8(isLetter(needle[n - 1]) ? 0x20 : 0);
+    for (; i <= lastStart && i + n - 1 + 16 <= readable; i += 16) {
+        __m128i blockFirst = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i)), foldFirst);
+        __m128i blockLast = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i + n - 1)), foldLast);
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+        if (lastStart - i < 15) {
+            mask &= (1u << (lastStart - i + 1)) - 1;  // starts past lastStart would run off the text
+        }
+        while (mask != 0) {
+            if (equalFolded(text + i + __builtin_ctz(mask), needle.data(), n)) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i <= lastStart; i++) {
+        if (equalFolded(text + i, needle.data(), n)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *findSubstring(const char *begin, const char *end, std::string_view needle) {
+    size_t n = needle.size();
+    if (n == 0) {
+        return begin;
+    }
+#ifdef _WIN32
+    for (const char *p = begin; end - p >= (ptrdiff_t)n;) {
+        p = (const char *)memchr(p, needle[0], (end - p) - n + 1);
+        if (!p) {
+            break;
+        }
+        if (memcmp(p, needle.data(), n) == 0) {
+            return p;
+        }
+        p++;
+    }
+    return nullptr;
+#else
+    return (const char *)memmem(begin, end - begin, needle.data(), n);
+#endif
+}
+
+bool looksBinary(const char *data, uint64_t size) {
+    return memchr(data, '\0', (size_t)std::min<uint64_t>(size, BINARY_SNIFF_BYTES)) != nullptr;
+}
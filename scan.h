@@ -0,0 +1,31 @@
+#ifndef SCAN_H_INCLUDED
+#define SCAN_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Find the k-th (k >= 1) newline in [begin, end). Returns a pointer to it, or
+// nullptr if there are fewer than k; *found is set to the number of newlines
+// that were passed, including the returned one. Uses AVX2 where the CPU has it.
+const char *findNthNewline(const char *begin, const char *end, uint64_t k, uint64_t *found);
+
+// True if needle occurs in text[0, length), ignoring ASCII case; needle must
+// already be lowercase. readable is how many bytes from text on may be loaded,
+// at least length: the SSE2 loop reads whole blocks and only falls back to
+// byte by byte compares where fewer than that are left.
+bool containsFolded(const char *text, size_t length, size_t readable, std::string_view needle);
+
+// How much of the start of a file looksBinary() checks
+const size_t BINARY_SNIFF_BYTES = 4096;
+
+// True if a buffer looks like binary rather than text: there is a NUL byte
+// in its first BINARY_SNIFF_BYTES, as with grep and git
+bool looksBinary(const char *data, uint64_t size);
+
+// First occurrence of needle in [begin, end), or nullptr. This is the C
+// library's memmem, which is vectorized in glibc and the BSDs; a memchr on the
+// first byte followed by memcmp where there is no memmem.
+const char *findSubstring(const char *begin, const char *end, std::string_view needle);
+
+#endif // SCAN_H_INCLUDED
@@ -0,0 +1,132 @@
+#include "trace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+static const char *const OP_NAMES[TRACE_OP_COUNT] = {"readdir", "metadata", "stat", "walk", "redraw", "map", "scan"};
+static const char *const ITEM_NAMES[TRACE_OP_COUNT] = {"entries", "entries", "stats", "entries", "frames",
+                                                       "bytes", "bytes"};
+
+const char *traceOpName(TraceOp op) {
+    return OP_NAMES[op];
+}
+
+const char *traceItemName(TraceOp op) {
+    return ITEM_NAMES[op];
+}
+
+#ifdef HAVE_TRACE
+
+struct TraceCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> ns{0};
+    std::atomic<uint64_t> maxNs{0};
+    std::atomic<uint64_t> lastItems{0};
+    std::atomic<uint64_t> lastNs{0};
+};
+
+static TraceCounters counters[TRACE_OP_COUNT];
+
+static std::mutex traceFileMutex;
+static FILE *traceFile = nullptr;
+static std::chrono::steady_clock::time_point traceStart;
+
+void traceAdd(TraceOp op, uint64_t items, uint64_t ns, std::string_view detail) {
+    if (items == 0) {
+        return;
+    }
+    TraceCounters &counter = counters[op];
+    counter.calls.fetch_add(1, std::memory_order_relaxed);
+    counter.items.fetch_add(items, std::memory_order_relaxed);
+    counter.ns.fetch_add(ns, std::memory_order_relaxed);
+    counter.lastItems.store(items, std::memory_order_relaxed);
+    counter.lastNs.store(ns, std::memory_order_relaxed);
+    uint64_t slowest = counter.maxNs.load(std::memory_order_relaxed);
+    while (ns > slowest && !counter.maxNs.compare_exchange_weak(slowest, ns, std::memory_order_relaxed)) {
+    }
+
+    if (op == TRACE_STAT) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(traceFileMutex);
+    if (traceFile) {
+        double sinceStart = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - traceStart).count();
+        fprintf(traceFile, "%.3f\t%s\t%llu\t%.3f\t%.*s\n", sinceStart, OP_NAMES[op], (unsigned long long)items,
+                ns / 1e6, (int)detail.size(), detail.data());
+    }
+}
+
+TraceTotals traceTotals(TraceOp op) {
+    const TraceCounters &counter = counters[op];
+    TraceTotals totals;
+    totals.calls = counter.calls.load(std::memory_order_relaxed);
+    totals.items = counter.items.load(std::memory_order_relaxed);
+    totals.ns = counter.ns.load(std::memory_order_relaxed);
+    totals.maxNs = counter.maxNs.load(std::memory_order_relaxed);
+    totals.lastItems = counter.lastItems.load(std::memory_order_relaxed);
+    totals.lastNs = counter.lastNs.load(std::memory_order_relaxed);
+    return totals;
+}
+
+// Totals of the whole run at the end of the trace file, stats included
+static void closeTraceFile() {
+    std::lock_guard<std::mutex> lock(traceFileMutex);
+    if (!traceFile) {
+        return;
+    }
+    fprintf(traceFile, "# op\tcalls\titems\ttotal ms\tmax ms\n");
+    for (int op = 0; op < TRACE_OP_COUNT; op++) {
+        TraceTotals totals = traceTotals((TraceOp)op);
+        fprintf(traceFile, "# %s\t%llu\t%llu\t%.3f\t%.3f\n", OP_NAMES[op], (unsigned long long)totals.calls,
+                (unsigned long long)totals.items, totals.ns / 1e6, totals.maxNs / 1e6);
+    }
+    fclose(traceFile);
+    traceFile = nullptr;
+}
+
+bool openTraceFile(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(traceFileMutex);
+    traceFile = file;
+    traceStart = std::chrono::steady_clock::now();
+    fprintf(traceFile, "# ms\top\titems\tms\tdetail\n");
+    atexit(closeTraceFile);
+    return true;
+}
+
+#endif
+
+int takeTraceOption(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") != 0) {
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "traverse: --trace needs a file name\n");
+            return -1;
+        }
+#ifdef HAVE_TRACE
+        if (!openTraceFile(argv[i + 1])) {
+            fprintf(stderr, "traverse: %s: %s\n", argv[i + 1], strerror(errno));
+            return -1;
+        }
+#else
+        fprintf(stderr, "traverse: --trace: this build has no tracing; use a Debug build\n");
+        return -1;
+#endif
+        // Shift what follows over the option and its file name
+        for (int j = i + 2; j <= argc; j++) {
+            argv[j - 2] = argv[j];
+        }
+        return argc - 2;
+    }
+    return argc;
+}
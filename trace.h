@@ -0,0 +1,101 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Timing of the operations that decide how fast traverse is on a given
+// machine and file system, for the performance overlay and --trace. The
+// timers are compiled in unless NDEBUG is defined, as it is for Release
+// builds, and then cost two steady_clock reads and a few atomic adds.
+#ifndef NDEBUG
+#define HAVE_TRACE
+#endif
+
+enum TraceOp {
+    TRACE_READDIR,   // getDirectoryContents(): entries read
+    TRACE_METADATA,  // fillMetadata(): entries stat'ed
+    TRACE_STAT,      // one stat call, from fillMetadata() or a walk
+    TRACE_WALK,      // walkTrees(): entries visited
+    TRACE_REDRAW,    // one frame of the directory view
+    TRACE_MAP,       // the viewer mapping a file: bytes mapped
+    TRACE_SCAN,      // the viewer indexing lines: bytes scanned
+    TRACE_OP_COUNT
+};
+
+// Name of an operation and of what its items are, for the overlay and the trace file
+const char *traceOpName(TraceOp op);
+const char *traceItemName(TraceOp op);
+
+// Everything recorded for one kind of operation so far
+struct TraceTotals {
+    uint64_t calls = 0;
+    uint64_t items = 0;
+    uint64_t ns = 0;
+    uint64_t maxNs = 0;  // the slowest single call
+    uint64_t lastItems = 0;
+    uint64_t lastNs = 0;
+};
+
+#ifdef HAVE_TRACE
+
+// Count one operation; calls that did nothing (no items) are left out. With
+// a trace file open each operation but TRACE_STAT, of which there are too
+// many, is also written to it as a line.
+void traceAdd(TraceOp op, uint64_t items, uint64_t ns, std::string_view detail);
+
+TraceTotals traceTotals(TraceOp op);
+
+// Write every operation from now on to the file at path, as tab separated
+// lines of: milliseconds since the file was opened, operation, items,
+// milliseconds it took, and what it was done on (a path, mostly)
+bool openTraceFile(const std::string &path);
+
+// Times the scope it lives in, or up to finish(), as one operation on items
+// things, 1 unless set
+class TraceTimer {
+public:
+    explicit TraceTimer(TraceOp op, std::string_view detail = std::string_view())
+        : op(op), detail(detail), start(std::chrono::steady_clock::now()) {}
+    ~TraceTimer() { finish(); }
+    TraceTimer(const TraceTimer &) = delete;
+    TraceTimer &operator=(const TraceTimer &) = delete;
+
+    void setItems(uint64_t count) { items = count; }
+
+    void finish() {
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+        traceAdd(op, items, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), detail);
+        items = 0;
+    }
+
+private:
+    TraceOp op;
+    std::string_view detail;
+    std::chrono::steady_clock::time_point start;
+    uint64_t items = 1;
+};
+
+#else
+
+inline void traceAdd(TraceOp, uint64_t, uint64_t, std::string_view) {}
+inline TraceTotals traceTotals(TraceOp) { return TraceTotals(); }
+inline bool openTraceFile(const std::string &) { return false; }
+
+class TraceTimer {
+public:
+    explicit TraceTimer(TraceOp, std::string_view = std::string_view()) {}
+    void setItems(uint64_t) {}
+    void finish() {}
+};
+
+#endif
+
+// Handle a --trace FILE option: it is taken out of argv, and the file
+// opened. Returns the number of arguments left, or -1 after printing why the
+// file can't be written.
+int takeTraceOption(int argc, char **argv);
+
+#endif // TRACE_H_INCLUDED
@@ -0,0 +1,329 @@
+#include "treeindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "events.h"
+#include "walker.h"
+
+static const char TREE_INDEX_MAGIC[8] = {'T', 'R', 'V', 'T', 'R', 'E', 'E', '1'};
+
+// Start of an index file. The root path follows, padded to 8 bytes, then
+// the directories sorted by path, their entries, and the names.
+struct TreeIndexHeader {
+    char magic[8];
+    uint64_t rootLength;
+    uint64_t dirCount;
+    uint64_t entryCount;
+    uint64_t namesBytes;
+};
+
+static uint64_t padded(uint64_t length) {
+    return (length + 7) & ~(uint64_t)7;
+}
+
+// Path relative to root, or false if path isn't root or below it. Paths
+// built below "/" start with "//", which comes out the same.
+static bool relativeTo(std::string_view root, std::string_view path, std::string_view &relative) {
+    if (path.substr(0, root.size()) != root) {
+        return false;
+    }
+    std::string_view rest = path.substr(root.size());
+    if (!rest.empty() && rest[0] != '/' && (root.empty() || root.back() != '/')) {
+        return false;  // "/data2" isn't below "/data"
+    }
+    while (!rest.empty() && rest[0] == '/') {
+        rest.remove_prefix(1);
+    }
+    relative = rest;
+    return true;
+}
+
+std::string treeIndexPath(const std::string &root) {
+    std::string dir = cacheDirectory();
+    if (dir.empty()) {
+        return "";
+    }
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (unsigned char c : root) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.treeidx", (unsigned long long)hash);
+    return dir + name;
+}
+
+std::shared_ptr<const TreeIndex> TreeIndex::find(const std::string &path) {
+    std::string root = path;
+    while (!root.empty()) {
+        std::string indexPath = treeIndexPath(root);
+        if (indexPath.empty()) {
+            break;
+        }
+        std::shared_ptr<TreeIndex> index = std::make_shared<TreeIndex>();
+        if (index->open(indexPath) && index->root() == root) {
+            return index;
+        }
+        size_t slash = root.find_last_of('/');
+        root = slash == std::string::npos || root == "/" ? "" : slash == 0 ? "/" : root.substr(0, slash);
+    }
+    return nullptr;
+}
+
+bool TreeIndex::open(const std::string &indexPath) {
+    if (!file.open(indexPath) || file.size() < sizeof(TreeIndexHeader)) {
+        return false;
+    }
+    TreeIndexHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, TREE_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.rootLength > file.size() ||
+        header.dirCount > file.size() / sizeof(IndexDirectory) || header.entryCount > file.size() / sizeof(IndexEntry)) {
+        return false;
+    }
+    uint64_t dirsOffset = sizeof(header) + padded(header.rootLength);
+    uint64_t entriesOffset = dirsOffset + header.dirCount * sizeof(IndexDirectory);
+    uint64_t namesOffset = entriesOffset + header.entryCount * sizeof(IndexEntry);
+    if (namesOffset + header.namesBytes != file.size()) {
+        return false;  // truncated, or not written by this version
+    }
+
+    rootPath.assign(file.data() + sizeof(header), header.rootLength);
+    dirs = (const IndexDirectory *)(file.data() + dirsOffset);
+    dirCount = header.dirCount;
+    entries = (const IndexEntry *)(file.data() + entriesOffset);
+    names = file.data() + namesOffset;
+    namesBytes = header.namesBytes;
+
+    // Entries are only ever reached through their directory, so what those
+    // point at is checked here; the entries themselves, which may run to
+    // hundreds of megabytes, are checked by directory() as they are looked up
+    for (uint64_t i = 0; i < dirCount; i++) {
+        const IndexDirectory &dir = dirs[i];
+        if (dir.pathOffset + dir.pathLength > header.namesBytes || dir.namesOffset > header.namesBytes ||
+            dir.firstEntry + dir.entryCount > header.entryCount) {
+            dirs = nullptr;
+            dirCount = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TreeIndex::covers(const std::string &path) const {
+    std::string_view relative;
+    return relativeTo(rootPath, path, relative);
+}
+
+const IndexDirectory *TreeIndex::directory(std::string_view path, int64_t mtime, int64_t ctime) const {
+    std::string_view relative;
+    if (!relativeTo(rootPath, path, relative)) {
+        return nullptr;
+    }
+    const IndexDirectory *found = std::lower_bound(dirs, dirs + dirCount, relative,
+                                                   [&](const IndexDirectory &dir, std::string_view key) {
+        return std::string_view(names + dir.pathOffset, dir.pathLength) < key;
+    });
+    if (found == dirs + dirCount || std::string_view(names + found->pathOffset, found->pathLength) != relative) {
+        return nullptr;
+    }
+    return found->mtime == mtime && found->ctime == ctime && entriesValid(*found) ? found : nullptr;
+}
+
+// Whether every entry of a directory has its NUL terminated name inside the
+// names, so that a corrupt or foreign file can't make name() read past them
+bool TreeIndex::entriesValid(const IndexDirectory &dir) const {
+    for (uint32_t i = 0; i < dir.entryCount; i++) {
+        const IndexEntry &indexed = entry(dir, i);
+        uint64_t end = dir.namesOffset + indexed.nameOffset + indexed.nameLength;
+        if (end >= namesBytes || names[end] != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TreeIndex::list(const std::string &path, DirListing &listing) const {
+    int64_t mtime, ctime;
+    if (!readDirectoryStamp(path, mtime, ctime)) {
+        return false;
+    }
+    const IndexDirectory *dir = directory(path, mtime, ctime);
+    if (!dir) {
+        return false;
+    }
+
+    listing = DirListing();
+    listing.path = path;
+    listing.readable = true;
+    listing.dirMtime = mtime;
+    listing.dirCtime = ctime;
+    listing.entries.reserve(dir->entryCount + 2);
+    addEntry(listing, ".", ENTRY_DIR);
+    addEntry(listing, "..", ENTRY_DIR);
+    // Only names and types: the directory's stamp doesn't change when a file
+    // in it is written to, so sizes and times may be long out of date
+    for (uint32_t i = 0; i < dir->entryCount; i++) {
+        const IndexEntry &indexed = entry(*dir, i);
+        addEntry(listing, std::string_view(name(*dir, indexed), indexed.nameLength), indexed.type);
+    }
+    return true;
+}
+
+// A directory being indexed
+struct IndexedDirectory {
+    std::vector<IndexEntry> entries;
+    std::string names;
+    int64_t mtime = 0;
+    int64_t ctime = 0;
+    bool complete = true;  // every entry could be stat'ed
+};
+
+struct IndexJob {
+    std::string root;
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> succeeded{false};
+    std::atomic<size_t> scanned{0};
+};
+
+// Write the directories out in the index format, sorted by path relative to root
+static bool writeIndex(const std::string &root, std::unordered_map<std::string, IndexedDirectory> &dirs,
+                       const std::string &indexPath) {
+    std::vector<std::pair<std::string_view, const IndexedDirectory *>> sorted;
+    for (const auto &dir : dirs) {
+        std::string_view relative;
+        // Directories that couldn't be read show up empty: leave those, and the truly empty, to be read from disk
+        if (relativeTo(root, dir.first, relative) && !dir.second.entries.empty() && dir.second.complete) {
+            sorted.emplace_back(relative, &dir.second);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    TreeIndexHeader header;
+    memcpy(header.magic, TREE_INDEX_MAGIC, sizeof(header.magic));
+    header.rootLength = root.size();
+    header.dirCount = sorted.size();
+    header.entryCount = 0;
+    header.namesBytes = 0;
+    std::vector<IndexDirectory> records;
+    for (const auto &dir : sorted) {
+        IndexDirectory record = {};
+        record.pathOffset = header.namesBytes;
+        record.pathLength = (uint32_t)dir.first.size();
+        record.namesOffset = record.pathOffset + dir.first.size() + 1;
+        record.firstEntry = header.entryCount;
+        record.entryCount = (uint32_t)dir.second->entries.size();
+        record.mtime = dir.second->mtime;
+        record.ctime = dir.second->ctime;
+        records.push_back(record);
+        header.namesBytes = record.namesOffset + dir.second->names.size();
+        header.entryCount += record.entryCount;
+    }
+
+    // Write to a temporary file first so a reader never sees half an index
+    std::string tempPath = indexPath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        static const char padding[8] = {};
+        out.write((const char *)&header, sizeof(header));
+        out.write(root.data(), root.size());
+        out.write(padding, padded(root.size()) - root.size());
+        out.write((const char *)records.data(), records.size() * sizeof(IndexDirectory));
+        for (const auto &dir : sorted) {
+            out.write((const char *)dir.second->entries.data(), dir.second->entries.size() * sizeof(IndexEntry));
+        }
+        for (const auto &dir : sorted) {
+            out.write(dir.first.data(), dir.first.size());
+            out.put('\0');
+            out.write(dir.second->names.data(), dir.second->names.size());
+        }
+        if (!out) {
+            out.close();
+            remove(tempPath.c_str());
+            return false;
+        }
+    }
+#ifdef _WIN32
+    remove(indexPath.c_str());  // rename() doesn't replace existing files on Windows
+#endif
+    return rename(tempPath.c_str(), indexPath.c_str()) == 0;
+}
+
+static void buildIndex(std::shared_ptr<IndexJob> job) {
+    std::mutex mutex;
+    std::unordered_map<std::string, IndexedDirectory> dirs;
+    // Each directory's stamp is taken before it is read, so whatever changes meanwhile makes it stale
+    IndexedDirectory &rootDir = dirs[job->root];
+    bool stamped = readDirectoryStamp(job->root, rootDir.mtime, rootDir.ctime);
+
+    WalkOptions options;
+    options.oneFileSystem = true;
+    options.statEntries = true;
+    walkTrees({job->root}, options, [&](const WalkEntry &found) {
+        job->scanned.fetch_add(1, std::memory_order_relaxed);
+        IndexEntry entry = {};
+        entry.nameLength = (uint16_t)found.nameLength;
+        entry.type = found.type;
+        entry.mode = found.mode;
+        entry.nlink = found.nlink;
+        entry.ino = found.ino;
+        entry.size = found.size;
+        entry.mtime = found.mtime;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        IndexedDirectory &dir = dirs[*found.dirPath];
+        dir.complete = dir.complete && found.hasStat;
+        entry.nameOffset = (uint32_t)dir.names.size();
+        dir.names.append(found.name, found.nameLength);
+        dir.names.push_back('\0');
+        dir.entries.push_back(entry);
+        if (found.type == ENTRY_DIR && found.hasStat) {
+            std::string child = *found.dirPath + "/";
+            child.append(found.name, found.nameLength);
+            IndexedDirectory &sub = dirs[child];
+            sub.mtime = found.mtimeNs;
+            sub.ctime = found.ctimeNs;
+        }
+    }, job->cancelled);
+
+    std::string indexPath = treeIndexPath(job->root);
+    job->succeeded = stamped && !job->cancelled && !indexPath.empty() && writeIndex(job->root, dirs, indexPath);
+    job->finished = true;
+    wakeUi();
+}
+
+TreeIndexer::~TreeIndexer() {
+    cancel();
+}
+
+void TreeIndexer::start(const std::string &root) {
+    cancel();
+    job = std::make_shared<IndexJob>();
+    job->root = root;
+    std::thread(buildIndex, job).detach();
+}
+
+void TreeIndexer::cancel() {
+    if (job) {
+        job->cancelled = true;
+        job.reset();
+    }
+}
+
+bool TreeIndexer::finished() const {
+    return job && job->finished;
+}
+
+bool TreeIndexer::succeeded() const {
+    return job && job->succeeded;
+}
+
+size_t TreeIndexer::scanned() const {
+    return job ? job->scanned.load() : 0;
+}
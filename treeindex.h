@@ -0,0 +1,114 @@
+#ifndef TREEINDEX_H_INCLUDED
+#define TREEINDEX_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "listing.h"
+#include "viewer.h"
+
+// One directory of a TreeIndex, as stored in the file
+struct IndexDirectory {
+    uint64_t pathOffset;   // into the names: relative to the root, "" for the root itself
+    uint64_t namesOffset;  // where the names of its entries start
+    uint64_t firstEntry;
+    uint32_t pathLength;
+    uint32_t entryCount;
+    int64_t mtime;  // the directory's stamp when it was read, as readDirectoryStamp() gives it
+    int64_t ctime;
+};
+
+// One entry of an indexed directory, as stored in the file
+struct IndexEntry {
+    uint32_t nameOffset;  // from the directory's namesOffset, NUL terminated
+    uint16_t nameLength;
+    uint8_t type;         // EntryType
+    uint8_t reserved;
+    uint32_t mode;
+    uint32_t nlink;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+};
+
+// Names and stat data of everything in a tree, written by a TreeIndexer and
+// memory mapped to be read. A directory is only looked up while its mtime
+// and ctime are what they were when it was indexed, so entries added,
+// removed or renamed since make it be read from disk again; sizes and times
+// of the files inside are as of when the index was written, as with the
+// DirCache.
+class TreeIndex {
+public:
+    // The index of path or of its nearest ancestor that has one, or null
+    static std::shared_ptr<const TreeIndex> find(const std::string &path);
+
+    bool open(const std::string &indexPath);
+
+    const std::string &root() const { return rootPath; }
+
+    // True if path is the root or below it
+    bool covers(const std::string &path) const;
+
+    // The directory at path if it is indexed with this stamp, else null
+    const IndexDirectory *directory(std::string_view path, int64_t mtime, int64_t ctime) const;
+
+    const IndexEntry &entry(const IndexDirectory &dir, uint32_t i) const { return entries[dir.firstEntry + i]; }
+    const char *name(const IndexDirectory &dir, const IndexEntry &entry) const {
+        return names + dir.namesOffset + entry.nameOffset;
+    }
+
+    // Fill listing with the names and types of the entries of path, if it is
+    // indexed and unchanged. Their metadata is left to be fetched, as after
+    // getDirectoryContents().
+    bool list(const std::string &path, DirListing &listing) const;
+
+private:
+    bool entriesValid(const IndexDirectory &dir) const;
+    bool relativePath(std::string_view path, std::string_view &relative) const;
+
+    MappedFile file;
+    std::string rootPath;
+    const IndexDirectory *dirs = nullptr;
+    uint64_t dirCount = 0;
+    const IndexEntry *entries = nullptr;
+    const char *names = nullptr;
+    uint64_t namesBytes = 0;
+};
+
+// Path of the index file for the tree at root, or "" if there is no cache directory
+std::string treeIndexPath(const std::string &root);
+
+struct IndexJob;
+
+// Writes the index of a tree on a background thread: the tree is walked with
+// walkTrees(), without leaving the file system it starts on, and the index
+// written to a temporary file that replaces the old one once it is complete.
+class TreeIndexer {
+public:
+    ~TreeIndexer();
+
+    // Start indexing the tree at root, cancelling any earlier job
+    void start(const std::string &root);
+    void cancel();
+
+    // True while a job has been started and not yet collected by finished()
+    bool active() const { return job != nullptr; }
+
+    // True once the index has been written, or writing it failed
+    bool finished() const;
+    bool succeeded() const;
+
+    // Entries seen so far
+    size_t scanned() const;
+
+    void clear() { job.reset(); }
+
+private:
+    std::shared_ptr<IndexJob> job;
+};
+
+#endif // TREEINDEX_H_INCLUDED
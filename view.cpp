@@ -0,0 +1,407 @@
+#include "view.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "scan.h"
+
+// Views at least this big are sorted in chunks on several threads
+static const size_t PARALLEL_SORT_MIN = 32 * 1024;
+
+// Order of the groups within a view
+enum SortGroup : uint32_t {
+    GROUP_DOTS,  // "." and ".."
+    GROUP_DIRS,
+    GROUP_OTHER
+};
+
+// One entry with everything needed to compare it without touching the listing
+struct SortItem {
+    uint64_t key;
+    uint64_t nameKey;  // decides between equal keys before the names themselves do
+    uint32_t index;
+    uint32_t group;
+};
+
+struct SortOrder {
+    const DirListing &listing;
+    SortMode mode;
+    bool descending;
+
+    bool operator()(const SortItem &a, const SortItem &b) const {
+        if (a.group != b.group) {
+            return a.group < b.group;
+        }
+        bool reverse = descending && a.group != GROUP_DOTS;
+        if (a.key != b.key) {
+            return reverse ? a.key > b.key : a.key < b.key;
+        }
+        // Equal keys: names decide, ascending unless names are what is being sorted
+        if (a.nameKey != b.nameKey) {
+            return reverse && mode == SORT_NAME ? a.nameKey > b.nameKey : a.nameKey < b.nameKey;
+        }
+        std::string_view nameA = listing.nameView(listing.entries[a.index]);
+        std::string_view nameB = listing.nameView(listing.entries[b.index]);
+        int order = compareNatural(nameA, nameB);
+        if (mode == SORT_NAME && reverse) {
+            order = -order;
+        }
+        if (order != 0) {
+            return order < 0;
+        }
+        return a.index < b.index;
+    }
+};
+
+const char *sortModeName(SortMode mode) {
+    switch (mode) {
+    case SORT_NAME:
+        return "name";
+    case SORT_SIZE:
+        return "size";
+    case SORT_MTIME:
+        return "time";
+    case SORT_TYPE:
+        return "type";
+    default:
+        return "";
+    }
+}
+
+static bool isDigit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static unsigned char foldCase(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+int compareNatural(std::string_view a, std::string_view b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        unsigned char ca = a[i], cb = b[j];
+        bool digitA = isDigit(ca), digitB = isDigit(cb);
+        if (digitA && digitB) {
+            // Compare the numbers: without leading zeros, longer is bigger
+            size_t startA = i, startB = j;
+            while (startA < a.size() && a[startA] == '0') {
+                startA++;
+            }
+            while (startB < b.size() && b[startB] == '0') {
+                startB++;
+            }
+            size_t endA = startA, endB = startB;
+            while (endA < a.size() && isDigit(a[endA])) {
+                endA++;
+            }
+            while (endB < b.size() && isDigit(b[endB])) {
+                endB++;
+            }
+            if (endA - startA != endB - startB) {
+                return endA - startA < endB - startB ? -1 : 1;
+            }
+            int order = a.substr(startA, endA - startA).compare(b.substr(startB, endB - startB));
+            if (order != 0) {
+                return order < 0 ? -1 : 1;
+            }
+            i = endA;
+            j = endB;
+            continue;
+        }
+        if (digitA != digitB) {
+            return digitA ? -1 : 1;  // numbers sort before any other character
+        }
+        ca = foldCase(ca);
+        cb = foldCase(cb);
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+        i++;
+        j++;
+    }
+    if (i < a.size() || j < b.size()) {
+        return i < a.size() ? 1 : -1;
+    }
+    // The same but for case or leading zeros: fall back to the bytes, so the order is total
+    int order = a.compare(b);
+    return order < 0 ? -1 : order > 0 ? 1 : 0;
+}
+
+// Up to the first 8 casefolded bytes of text, big endian and zero padded
+static uint64_t prefixKey(std::string_view text) {
+    uint64_t key = 0;
+    size_t length = 0;
+    for (; length < text.size() && length < 8; length++) {
+        key = (key << 8) | foldCase(text[length]);
+    }
+    return length == 0 ? 0 : key << (8 * (8 - length));
+}
+
+// Key for a name such that keys that differ order names like compareNatural()
+// does. Text is stored as casefolded bytes. A number is stored as a byte from
+// 1 to 8 giving the length of its value, which sorts it below any character,
+// and then the value itself, big endian. Characters below 10, never seen in
+// practice, end the key.
+static uint64_t naturalKey(std::string_view name) {
+    unsigned char bytes[8] = {};
+    size_t length = 0;
+    for (size_t i = 0; i < name.size() && length < 8;) {
+        unsigned char c = name[i];
+        if (c < 10) {
+            bytes[length++] = 9;
+            break;
+        }
+        if (!isDigit(c)) {
+            bytes[length++] = foldCase(c);
+            i++;
+            continue;
+        }
+        uint64_t value = 0;
+        size_t digits = 0;
+        for (; i < name.size() && isDigit(name[i]); i++) {
+            if (value != 0 || name[i] != '0') {
+                digits++;
+            }
+            value = value * 10 + (name[i] - '0');
+        }
+        if (digits > 19) {
+            value = ~0ULL;  // beyond 64 bits; only the names can tell these apart
+        }
+        int valueBytes = 1;
+        while (valueBytes < 8 && (value >> (8 * valueBytes)) != 0) {
+            valueBytes++;
+        }
+        bytes[length++] = (unsigned char)valueBytes;
+        for (int k = valueBytes - 1; k >= 0 && length < 8; k--) {
+            bytes[length++] = (unsigned char)(value >> (8 * k));
+        }
+        if (digits > 19) {
+            break;
+        }
+    }
+    uint64_t key = 0;
+    for (unsigned char c : bytes) {
+        key = (key << 8) | c;
+    }
+    return key;
+}
+
+// Give every entry that doesn't have one yet its name key
+static void updateNameKeys(ListingView &view, const DirListing &listing) {
+    if (view.nameKeys.size() > listing.entries.size()) {
+        view.nameKeys.clear();  // a different, smaller listing
+    }
+    for (size_t i = view.nameKeys.size(); i < listing.entries.size(); i++) {
+        view.nameKeys.push_back(naturalKey(listing.nameView(listing.entries[i])));
+    }
+}
+
+static SortItem makeItem(const ListingView &view, const DirListing &listing, uint32_t index) {
+    const DirEntry &entry = listing.entries[index];
+    std::string_view name = listing.nameView(entry);
+    SortItem item;
+    item.index = index;
+    item.nameKey = view.nameKeys[index];
+    item.group = name == "." || name == ".." ? GROUP_DOTS : listing.isDir(entry) ? GROUP_DIRS : GROUP_OTHER;
+    switch (view.mode) {
+    case SORT_SIZE:
+        item.key = entry.size > 0 ? (uint64_t)entry.size : 0;
+        break;
+    case SORT_MTIME:
+        item.key = (uint64_t)entry.mtime ^ (1ULL << 63);  // signed to unsigned order
+        break;
+    case SORT_TYPE: {
+        size_t dot = name.rfind('.');
+        item.key = dot == std::string_view::npos || dot == 0 ? 0 : prefixKey(name.substr(dot + 1));
+        break;
+    }
+    default:
+        item.key = item.nameKey;
+        item.nameKey = 0;
+        break;
+    }
+    return item;
+}
+
+// Sort items, splitting big arrays into one chunk per thread and merging the
+// sorted chunks pairwise, also in parallel
+static void sortItems(std::vector<SortItem> &items, const SortOrder &order) {
+    size_t threads = std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+    if (items.size() < PARALLEL_SORT_MIN || threads < 2) {
+        std::sort(items.begin(), items.end(), order);
+        return;
+    }
+
+    size_t chunks = 1;
+    while (chunks * 2 <= threads) {
+        chunks *= 2;
+    }
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; i++) {
+        bounds[i] = items.size() * i / chunks;
+    }
+    auto at = [&](size_t chunk) { return items.begin() + bounds[std::min(chunk, chunks)]; };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < chunks; i++) {
+        workers.emplace_back([&, i] { std::sort(at(i), at(i + 1), order); });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    for (size_t width = 1; width < chunks; width *= 2) {
+        workers.clear();
+        for (size_t i = 0; i + width < chunks; i += 2 * width) {
+            workers.emplace_back([&, i, width] { std::inplace_merge(at(i), at(i + width), at(i + 2 * width), order); });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+}
+
+static bool matchesFilter(const ListingView &view, const DirListing &listing, uint32_t index) {
+    const DirEntry &entry = listing.entries[index];
+    return containsFolded(listing.name(entry), entry.nameLength, listing.names.size() - entry.nameOffset,
+                          view.filter);
+}
+
+// Set view.order to the entries of candidates that match the filter, keeping their order
+static void filterEntries(ListingView &view, const DirListing &listing, const std::vector<uint32_t> &candidates) {
+    if (view.filter.empty()) {
+        view.order = candidates;
+        return;
+    }
+    std::vector<uint32_t> matches;
+    for (uint32_t index : candidates) {
+        if (matchesFilter(view, listing, index)) {
+            matches.push_back(index);
+        }
+    }
+    view.order.swap(matches);
+}
+
+// Merge added, which is sorted, into order, which should be
+static void mergeItems(const ListingView &view, const DirListing &listing, std::vector<uint32_t> &order,
+                       const std::vector<SortItem> &added) {
+    if (added.empty()) {
+        return;
+    }
+    std::vector<SortItem> shown;
+    shown.reserve(order.size());
+    for (uint32_t index : order) {
+        shown.push_back(makeItem(view, listing, index));
+    }
+    std::vector<SortItem> merged(shown.size() + added.size());
+    std::merge(shown.begin(), shown.end(), added.begin(), added.end(), merged.begin(),
+               SortOrder{listing, view.mode, view.descending});
+
+    order.resize(merged.size());
+    for (size_t i = 0; i < merged.size(); i++) {
+        order[i] = merged[i].index;
+    }
+}
+
+void sortView(ListingView &view, const DirListing &listing) {
+    updateNameKeys(view, listing);
+    std::vector<SortItem> items;
+    items.reserve(listing.entries.size());
+    for (size_t i = 0; i < listing.entries.size(); i++) {
+        items.push_back(makeItem(view, listing, (uint32_t)i));
+    }
+    sortItems(items, SortOrder{listing, view.mode, view.descending});
+
+    view.sorted.resize(items.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        view.sorted[i] = items[i].index;
+    }
+    filterEntries(view, listing, view.sorted);
+}
+
+void extendView(ListingView &view, const DirListing &listing) {
+    // The sorted order holds exactly the entries that have name keys
+    size_t first = view.nameKeys.size();
+    if (first > listing.entries.size() || view.sorted.size() != first) {
+        sortView(view, listing);
+        return;
+    }
+    updateNameKeys(view, listing);
+    if (first == listing.entries.size()) {
+        return;
+    }
+
+    std::vector<SortItem> added;
+    for (size_t i = first; i < listing.entries.size(); i++) {
+        added.push_back(makeItem(view, listing, (uint32_t)i));
+    }
+    sortItems(added, SortOrder{listing, view.mode, view.descending});
+    mergeItems(view, listing, view.sorted, added);
+
+    // Only the new entries need to be matched against the filter
+    if (!view.filter.empty()) {
+        size_t kept = 0;
+        for (const SortItem &item : added) {
+            if (matchesFilter(view, listing, item.index)) {
+                added[kept++] = item;
+            }
+        }
+        added.resize(kept);
+    }
+    mergeItems(view, listing, view.order, added);
+}
+
+// Move the entries of order to their new indices, dropping removed ones
+static void remapOrder(std::vector<uint32_t> &order, const std::vector<int32_t> &remap) {
+    size_t kept = 0;
+    for (uint32_t index : order) {
+        if (index < remap.size() && remap[index] >= 0) {
+            order[kept++] = (uint32_t)remap[index];
+        }
+    }
+    order.resize(kept);
+}
+
+void remapView(ListingView &view, const DirListing &listing, const std::vector<int32_t> &remap) {
+    if (view.nameKeys.size() != remap.size() || view.sorted.size() != remap.size()) {
+        sortView(view, listing);
+        return;
+    }
+    remapOrder(view.sorted, remap);
+    remapOrder(view.order, remap);
+
+    // Name keys move with their entries; compaction keeps them in order
+    size_t kept = 0;
+    for (size_t i = 0; i < remap.size(); i++) {
+        if (remap[i] >= 0) {
+            view.nameKeys[kept++] = view.nameKeys[i];
+        }
+    }
+    view.nameKeys.resize(kept);
+    extendView(view, listing);  // entries added after the compaction
+}
+
+void setFilter(ListingView &view, const DirListing &listing, std::string_view text) {
+    std::string filter;
+    for (char c : text) {
+        filter.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    }
+    bool narrower = filter.find(view.filter) != std::string::npos;
+    view.filter = filter;
+    if (narrower) {
+        // Anything containing the new filter contains the old one: only look at the previous matches
+        std::vector<uint32_t> previous;
+        previous.swap(view.order);
+        filterEntries(view, listing, previous);
+    } else {
+        filterEntries(view, listing, view.sorted);
+    }
+}
+
+int viewPosition(const ListingView &view, int entryIndex) {
+    for (size_t i = 0; i < view.order.size(); i++) {
+        if ((int)view.order[i] == entryIndex) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,72 @@
+#ifndef VIEW_H_INCLUDED
+#define VIEW_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "listing.h"
+
+enum SortMode {
+    SORT_NAME,   // natural order, ignoring case
+    SORT_SIZE,
+    SORT_MTIME,
+    SORT_TYPE,   // by extension
+    SORT_MODE_COUNT
+};
+
+// Name of a sort mode, for the status line
+const char *sortModeName(SortMode mode);
+
+// Order in which a listing is shown: indices into DirListing::entries. "."
+// and ".." always come first and directories before everything else; the
+// sort mode and direction only apply within those groups. With a filter set
+// only the entries whose names contain it are shown.
+struct ListingView {
+    std::vector<uint32_t> order;   // what is shown
+    std::vector<uint32_t> sorted;  // every entry, in the same order
+    SortMode mode = SORT_NAME;
+    bool descending = false;
+    std::string filter;  // lowercase; empty to show everything
+
+    // Casefolded name prefix of every entry, packed so that two that differ
+    // compare as integers like the names do with compareNatural(). Computed
+    // once per entry.
+    std::vector<uint64_t> nameKeys;
+
+    size_t size() const { return order.size(); }
+
+    // Forget the order and keys, for when the listing is replaced
+    void clear() {
+        order.clear();
+        sorted.clear();
+        nameKeys.clear();
+    }
+};
+
+// Compare two names in natural order: case-insensitive, with runs of digits
+// compared by value, so "file9" sorts before "file10"
+int compareNatural(std::string_view a, std::string_view b);
+
+// Sort every entry of the listing into the view
+void sortView(ListingView &view, const DirListing &listing);
+
+// Add entries appended to the listing since the view was last built, merging
+// them into place without sorting the whole view again
+void extendView(ListingView &view, const DirListing &listing);
+
+// Follow entries that moved after the listing was compacted: remap[old] is an
+// entry's new index, or -1 if it was removed. Entries appended afterwards are
+// merged in as by extendView().
+void remapView(ListingView &view, const DirListing &listing, const std::vector<int32_t> &remap);
+
+// Show only the entries whose names contain text, ignoring case. When text
+// extends the previous filter only the entries shown so far are checked.
+void setFilter(ListingView &view, const DirListing &listing, std::string_view text);
+
+// Position of an entry in the view, or -1 if it isn't shown
+int viewPosition(const ListingView &view, int entryIndex);
+
+#endif // VIEW_H_INCLUDED
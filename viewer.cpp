@@ -0,0 +1,1437 @@
+#include "viewer.h"
+
+#include <ncursesw/ncurses.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream> // For the index cache
+#include <atomic>
+#include <mutex>
+
+#include "compressed.h"
+#include "events.h"
+#include "scan.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>  // For reaping the default application
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#ifndef _WIN32
+// A file truncated while it is mapped makes reading the pages past its new
+// end raise SIGBUS, wherever that happens: drawing, a search, a grep worker
+// or the prefetcher. Mappings are registered here, and the handler puts zero
+// filled pages over the rest of the one that faulted, so the read sees NUL
+// bytes instead and the viewer reopens the file once it notices it shrank.
+// (Windows doesn't let a mapped file be truncated.)
+struct GuardedMapping {
+    std::atomic<uintptr_t> begin{0};  // 0 while the slot isn't in use
+    std::atomic<uintptr_t> end{0};    // 0 for a free slot
+};
+
+// Mappings that can be guarded at once; faults in any others are fatal as usual
+static const int GUARDED_MAPPINGS = 256;
+static GuardedMapping guardedMappings[GUARDED_MAPPINGS];
+static uintptr_t guardPageSize = 4096;
+
+static void onBusError(int signal, siginfo_t *info, void *) {
+    uintptr_t address = (uintptr_t)info->si_addr;
+    for (GuardedMapping &mapping : guardedMappings) {
+        uintptr_t begin = mapping.begin.load(std::memory_order_acquire);
+        uintptr_t end = mapping.end.load(std::memory_order_relaxed);
+        if (begin != 0 && address >= begin && address < end) {
+            uintptr_t page = address & ~(guardPageSize - 1);
+            if (mmap((void *)page, end - page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) !=
+                MAP_FAILED) {
+                return;  // the read is retried, on zeros
+            }
+        }
+    }
+    // Not one of ours: die of it as without the handler
+    struct sigaction fatal = {};
+    fatal.sa_handler = SIG_DFL;
+    sigaction(signal, &fatal, nullptr);
+}
+
+// Register a mapping for the SIGBUS handler; returns its slot, or -1 if all are taken
+static int guardMapping(const char *base, uint64_t length) {
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        guardPageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+        struct sigaction action = {};
+        action.sa_sigaction = onBusError;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, nullptr);
+    });
+    for (int i = 0; i < GUARDED_MAPPINGS; i++) {
+        // A slot is claimed by setting its end; the handler only looks at it once begin is set too
+        uintptr_t free = 0;
+        if (guardedMappings[i].end.compare_exchange_strong(free, (uintptr_t)base + length)) {
+            guardedMappings[i].begin.store((uintptr_t)base, std::memory_order_release);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void unguardMapping(int slot) {
+    if (slot >= 0) {
+        guardedMappings[slot].begin.store(0, std::memory_order_release);
+        guardedMappings[slot].end.store(0, std::memory_order_release);
+    }
+}
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string &path) {
+    close();
+    TraceTimer timer(TRACE_MAP, path);
+    timer.setItems(0);  // only files that get mapped count
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        close();
+        return false;
+    }
+    length = (uint64_t)fileSize.QuadPart;
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (GetFileInformationByHandle(file, &info)) {
+        ULARGE_INTEGER writeTime;
+        writeTime.LowPart = info.ftLastWriteTime.dwLowDateTime;
+        writeTime.HighPart = info.ftLastWriteTime.dwHighDateTime;
+        fileId = (((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow) ^
+                 ((uint64_t)info.dwVolumeSerialNumber * 0x9e3779b97f4a7c15ULL);
+        modifiedTime = (int64_t)writeTime.QuadPart;
+    }
+    if (length == 0) {
+        return true;  // empty files can't be mapped, but are valid
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        close();
+        return false;
+    }
+    mappingHandle = mapping;
+
+    base = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL) {
+        close();
+        return false;
+    }
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close();
+        return false;
+    }
+    length = (uint64_t)fileStat.st_size;
+    fileId = (uint64_t)fileStat.st_ino ^ ((uint64_t)fileStat.st_dev * 0x9e3779b97f4a7c15ULL);
+#ifdef __APPLE__
+    modifiedTime = (int64_t)fileStat.st_mtimespec.tv_sec * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+#else
+    modifiedTime = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+    if (length == 0) {
+        return true;  // empty files can't be mapped, but are valid
+    }
+
+    void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close();
+        return false;
+    }
+    base = (const char *)mapped;
+    guardSlot = guardMapping(base, length);
+#endif
+    timer.setItems(length);
+    return true;
+}
+
+FileChange MappedFile::changed() const {
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+    if (!fileHandle || !GetFileSizeEx((HANDLE)fileHandle, &fileSize)) {
+        return FILE_UNCHANGED;
+    }
+    uint64_t current = (uint64_t)fileSize.QuadPart;
+#else
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0) {
+        return FILE_UNCHANGED;
+    }
+    uint64_t current = (uint64_t)fileStat.st_size;
+#endif
+    return current > length ? FILE_GROWN : current < length ? FILE_SHRUNK : FILE_UNCHANGED;
+}
+
+bool MappedFile::remap() {
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+    if (!fileHandle || !GetFileSizeEx((HANDLE)fileHandle, &fileSize) || (uint64_t)fileSize.QuadPart <= length) {
+        return false;
+    }
+
+    // A view can't grow in place; map the file again at its new size
+    HANDLE mapping = CreateFileMappingA((HANDLE)fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        return false;
+    }
+    const char *mapped = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (mapped == NULL) {
+        CloseHandle(mapping);
+        return false;
+    }
+    if (base) {
+        UnmapViewOfFile(base);
+    }
+    if (mappingHandle) {
+        CloseHandle((HANDLE)mappingHandle);
+    }
+    mappingHandle = mapping;
+    base = mapped;
+    length = (uint64_t)fileSize.QuadPart;
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (GetFileInformationByHandle((HANDLE)fileHandle, &info)) {
+        ULARGE_INTEGER writeTime;
+        writeTime.LowPart = info.ftLastWriteTime.dwLowDateTime;
+        writeTime.HighPart = info.ftLastWriteTime.dwHighDateTime;
+        modifiedTime = (int64_t)writeTime.QuadPart;
+    }
+#else
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size <= length) {
+        return false;
+    }
+
+    uint64_t newLength = (uint64_t)fileStat.st_size;
+#ifdef __linux__
+    void *mapped = base ? mremap((void *)base, length, newLength, MREMAP_MAYMOVE)
+                        : mmap(NULL, newLength, PROT_READ, MAP_PRIVATE, fd, 0);
+#else
+    void *mapped = mmap(NULL, newLength, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED && base) {
+        munmap((void *)base, length);
+    }
+#endif
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    unguardMapping(guardSlot);
+    base = (const char *)mapped;
+    length = newLength;
+    guardSlot = guardMapping(base, length);
+#ifdef __APPLE__
+    modifiedTime = (int64_t)fileStat.st_mtimespec.tv_sec * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+#else
+    modifiedTime = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (base) {
+        UnmapViewOfFile(base);
+    }
+    if (mappingHandle) {
+        CloseHandle((HANDLE)mappingHandle);
+    }
+    if (fileHandle) {
+        CloseHandle((HANDLE)fileHandle);
+    }
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    unguardMapping(guardSlot);
+    guardSlot = -1;
+    if (base) {
+        munmap((void *)base, length);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+#endif
+    base = nullptr;
+    length = 0;
+    fileId = 0;
+    modifiedTime = 0;
+}
+
+void LineIndex::reset(const char *data, uint64_t size) {
+    this->data = data;
+    this->size = size;
+    checkpoints.assign(1, 0);
+    frontierLine = 0;
+    frontierOffset = 0;
+    totalLines = 0;
+    done = size == 0;
+}
+
+void LineIndex::extend(const char *data, uint64_t size) {
+    // The frontier is always at the start of a line, so the scan can resume
+    // there; an unterminated last line is simply scanned again
+    this->data = data;
+    this->size = size;
+    if (frontierOffset < size) {
+        done = false;
+    }
+}
+
+// Skip up to k lines past the frontier, stopping at the next checkpoint
+void LineIndex::advance(uint64_t k) {
+    uint64_t toCheckpoint = CHECKPOINT_LINES - frontierLine % CHECKPOINT_LINES;
+    k = std::min(k, toCheckpoint);
+
+    uint64_t found;
+    const char *newline = findNthNewline(data + frontierOffset, data + size, k, &found);
+    if (!newline && found > 0) {
+        // Ran off the end; find the last newline so the frontier lands after it
+        newline = findNthNewline(data + frontierOffset, data + size, found, &found);
+    }
+    if (newline) {
+        frontierLine += found;
+        frontierOffset = (uint64_t)(newline - data) + 1;
+        if (frontierLine % CHECKPOINT_LINES == 0) {
+            checkpoints.push_back(frontierOffset);
+        }
+    }
+
+    if (found < k || frontierOffset >= size) {
+        // Whatever follows the last newline is one more, unterminated, line
+        done = true;
+        totalLines = frontierLine + (frontierOffset < size ? 1 : 0);
+    }
+}
+
+void LineIndex::scanTo(uint64_t line) {
+    TraceTimer timer(TRACE_SCAN);
+    uint64_t from = frontierOffset;
+    while (!done && frontierLine < line) {
+        advance(line - frontierLine);
+    }
+    timer.setItems(frontierOffset - from);
+}
+
+void LineIndex::scanBytes(uint64_t offset) {
+    TraceTimer timer(TRACE_SCAN);
+    uint64_t from = frontierOffset;
+    while (!done && frontierOffset < offset) {
+        advance(CHECKPOINT_LINES);
+    }
+    timer.setItems(frontierOffset - from);
+}
+
+uint64_t LineIndex::resolve(uint64_t first, uint64_t count, std::vector<uint64_t> &starts) {
+    starts.clear();
+    scanTo(first + count);
+    uint64_t available = knownLines();
+    if (first >= available) {
+        return 0;
+    }
+    count = std::min(count, available - first);
+
+    // Start from the nearest checkpoint and skip the remaining lines
+    uint64_t offset = checkpoints[first / CHECKPOINT_LINES];
+    uint64_t skip = first % CHECKPOINT_LINES;
+    if (skip > 0) {
+        uint64_t found;
+        const char *newline = findNthNewline(data + offset, data + size, skip, &found);
+        offset = newline ? (uint64_t)(newline - data) + 1 : size;
+    }
+
+    starts.push_back(offset);
+    for (uint64_t i = 0; i < count; i++) {
+        const char *newline = (const char *)memchr(data + offset, '\n', size - offset);
+        offset = newline ? (uint64_t)(newline - data) + 1 : size;
+        starts.push_back(offset);
+    }
+    return count;
+}
+
+std::string_view LineIndex::text(uint64_t begin, uint64_t end) const {
+    if (end > begin && data[end - 1] == '\n') {
+        end--;
+    }
+    if (end > begin && data[end - 1] == '\r') {
+        end--;
+    }
+    return std::string_view(data + begin, end - begin);
+}
+
+// Header of a line index side cache file; followed by `count` checkpoints
+struct LineIndexCacheHeader {
+    char magic[8];
+    uint64_t fileId;
+    int64_t mtime;
+    uint64_t size;
+    uint64_t checkpointLines;
+    uint64_t frontierLine;
+    uint64_t frontierOffset;
+    uint64_t totalLines;
+    uint64_t done;
+    uint64_t count;
+};
+
+static const char LINE_INDEX_MAGIC[8] = {'T', 'R', 'V', 'L', 'I', 'D', 'X', '1'};
+
+bool LineIndex::load(const std::string &cachePath, uint64_t fileId, int64_t mtime) {
+    if (cachePath.empty()) {
+        return false;
+    }
+    std::ifstream in(cachePath, std::ios::binary);
+    LineIndexCacheHeader header;
+    if (!in.read((char *)&header, sizeof(header))) {
+        return false;
+    }
+
+    // Anything that doesn't match this exact file version is stale
+    if (memcmp(header.magic, LINE_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.fileId != fileId ||
+        header.mtime != mtime || header.size != size || header.checkpointLines != CHECKPOINT_LINES ||
+        header.frontierOffset > size || header.count == 0 ||
+        header.count != header.frontierLine / CHECKPOINT_LINES + 1) {
+        return false;
+    }
+
+    std::vector<uint64_t> loaded(header.count);
+    if (!in.read((char *)loaded.data(), loaded.size() * sizeof(uint64_t))) {
+        return false;
+    }
+    checkpoints.swap(loaded);
+    frontierLine = header.frontierLine;
+    frontierOffset = header.frontierOffset;
+    totalLines = header.totalLines;
+    done = header.done != 0;
+    return true;
+}
+
+bool LineIndex::save(const std::string &cachePath, uint64_t fileId, int64_t mtime) const {
+    if (cachePath.empty()) {
+        return false;
+    }
+
+    LineIndexCacheHeader header;
+    memcpy(header.magic, LINE_INDEX_MAGIC, sizeof(header.magic));
+    header.fileId = fileId;
+    header.mtime = mtime;
+    header.size = size;
+    header.checkpointLines = CHECKPOINT_LINES;
+    header.frontierLine = frontierLine;
+    header.frontierOffset = frontierOffset;
+    header.totalLines = totalLines;
+    header.done = done;
+    header.count = checkpoints.size();
+
+    // Write to a temporary file first so a reader never sees half an index
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write((const char *)&header, sizeof(header));
+        out.write((const char *)checkpoints.data(), checkpoints.size() * sizeof(uint64_t));
+        if (!out) {
+            return false;
+        }
+    }
+#ifdef _WIN32
+    remove(cachePath.c_str());  // rename() doesn't replace existing files on Windows
+#endif
+    return rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+std::string cacheDirectory() {
+    std::string dir;
+#ifdef _WIN32
+    const char *localAppData = getenv("LOCALAPPDATA");
+    if (!localAppData) {
+        return "";
+    }
+    dir = std::string(localAppData) + "\\traverse";
+    _mkdir(dir.c_str());
+#else
+    const char *cacheHome = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cacheHome && *cacheHome) {
+        dir = cacheHome;
+    } else if (home && *home) {
+        dir = std::string(home) + "/.cache";
+        mkdir(dir.c_str(), 0700);
+    } else {
+        return "";
+    }
+    dir += "/traverse";
+    mkdir(dir.c_str(), 0700);
+#endif
+    return dir;
+}
+
+std::string lineIndexCachePath(uint64_t fileId) {
+    std::string dir = cacheDirectory();
+    if (dir.empty()) {
+        return "";
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.lineidx", (unsigned long long)fileId);
+    return dir + name;
+}
+
+// Function to check if the file is readable
+bool isReadable(const std::string &filePath) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(filePath.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return false;
+    }
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    CloseHandle(file);
+    return true;
+#else
+    // A regular file we may read; devices, FIFOs and sockets can't be mapped
+    struct stat fileStat;
+    return stat(filePath.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode) && access(filePath.c_str(), R_OK) == 0;
+#endif
+}
+
+#ifndef _WIN32
+// Exit status, plus one so that 0 means none, of the last application that
+// failed. A lock-free atomic, so the SIGCHLD handler may set it.
+static std::atomic<int> failedLaunchStatus{0};
+
+static void reapLaunches(int) {
+    int savedErrno = errno;
+    int status;
+    while (waitpid(-1, &status, WNOHANG) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failedLaunchStatus = (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)) + 1;
+            wakeUi();
+        }
+    }
+    errno = savedErrno;
+}
+#endif
+
+// Function to open the file with the default application, without waiting for it
+bool openWithDefaultApplication(const std::string &filePath, std::string &error) {
+#ifdef _WIN32
+    // Use ShellExecute to open the file in the default application on Windows
+    INT_PTR result = (INT_PTR)ShellExecuteA(NULL, "open", filePath.c_str(), NULL, NULL, SW_SHOWNORMAL);
+    if (result <= 32) {
+        error = "No application to open " + filePath + " with (error " + std::to_string((long long)result) + ")";
+        return false;
+    }
+    return true;
+#else
+    // Children are reaped as they exit instead of being waited for
+    static bool handlerInstalled = false;
+    if (!handlerInstalled) {
+        struct sigaction action = {};
+        action.sa_handler = reapLaunches;
+        action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGCHLD, &action, NULL);
+        handlerInstalled = true;
+    }
+
+    // posix_spawn doesn't copy the page tables of this process, unlike fork.
+    // The child's output would land on top of the screen, so it goes nowhere.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+#ifdef __APPLE__
+    const char *openers[] = {"open"};
+#else
+    const char *openers[] = {"xdg-open", "open"};
+#endif
+    int result = ENOENT;
+    for (const char *opener : openers) {
+        char *argv[] = {(char *)opener, (char *)filePath.c_str(), NULL};
+        pid_t pid;
+        result = posix_spawnp(&pid, opener, &actions, NULL, argv, environ);
+        if (result == 0) {
+            break;
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (result != 0) {
+        error = std::string("Can't start xdg-open or open: ") + strerror(result);
+        return false;
+    }
+    return true;
+#endif
+}
+
+std::string takeLaunchFailure() {
+#ifndef _WIN32
+    int status = failedLaunchStatus.exchange(0);
+    if (status > 0) {
+        return "The default application failed (exit status " + std::to_string(status - 1) + ")";
+    }
+#endif
+    return "";
+}
+
+// How much of the buffer a search scans between progress updates and cancellation checks
+static const uint64_t SEARCH_CHUNK = 4ull << 20;
+
+// Hits a search keeps at most; it stops once it has found this many lines
+static const size_t SEARCH_MAX_HITS = 4u << 20;
+
+// How often the viewer checks on a search it is waiting for
+static const int SEARCH_POLL_MS = 50;
+
+struct SearchJob {
+    const char *data;
+    uint64_t size;
+    std::string pattern;
+    uint64_t start;      // where the scan began; it wraps around to there
+    uint64_t startLine;
+    std::atomic<bool> cancelled{false};
+
+    mutable std::mutex mutex;     // protects everything below
+    std::vector<SearchHit> hits;  // in scan order: from start to the end, then from 0 to start
+    uint64_t scanned = 0;         // bytes of the buffer done, in scan order
+    bool done = false;
+
+    // Position of an offset in scan order
+    uint64_t key(uint64_t offset) const { return offset >= start ? offset - start : offset + (size - start); }
+};
+
+// Scan for lines with a hit starting in [begin, end); line is the number of the line at begin
+static bool searchSegment(SearchJob &job, uint64_t begin, uint64_t end, uint64_t line) {
+    size_t n = job.pattern.size();
+    const char *bufferEnd = job.data + job.size;
+    const char *counted = job.data + begin;  // newlines before this are counted into line
+    std::vector<SearchHit> found;
+    uint64_t chunk = begin;
+    while (chunk < end && !job.cancelled) {
+        const char *p = job.data + chunk;
+        const char *limit = job.data + std::min(end, chunk + SEARCH_CHUNK);  // hits must start before this...
+        const char *readEnd = std::min(bufferEnd, limit + n - 1);           // ...but may end after it
+        while (p < limit) {
+            const char *hit = findSubstring(p, readEnd, job.pattern);
+            if (!hit || hit >= limit) {
+                p = limit;
+                break;
+            }
+            uint64_t passed = 0;
+            findNthNewline(counted, hit, UINT64_MAX, &passed);
+            line += passed;
+            counted = hit;
+            found.push_back({(uint64_t)(hit - job.data), line});
+
+            // One hit per line: carry on after it, even if that is past the chunk
+            const char *lineEnd = (const char *)memchr(hit, '\n', bufferEnd - hit);
+            p = lineEnd ? lineEnd + 1 : bufferEnd;
+        }
+        chunk = (uint64_t)(p - job.data);
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.hits.insert(job.hits.end(), found.begin(), found.end());
+        job.scanned = job.key(begin) + (chunk - begin);
+        found.clear();
+        if (job.hits.size() >= SEARCH_MAX_HITS) {
+            return false;
+        }
+    }
+    return !job.cancelled;
+}
+
+static void searchBuffer(std::shared_ptr<SearchJob> job) {
+    // From the starting line to the end, then from the top back to it
+    if (searchSegment(*job, job->start, job->size, job->startLine)) {
+        searchSegment(*job, 0, job->start, 0);
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->scanned = job->size;
+    job->done = true;
+}
+
+BufferSearch::~BufferSearch() {
+    cancel();
+}
+
+void BufferSearch::start(const char *data, uint64_t size, const std::string &pattern, uint64_t offset,
+                         uint64_t line) {
+    cancel();
+    job = std::make_shared<SearchJob>();
+    job->data = data;
+    job->size = size;
+    job->pattern = pattern;
+    job->start = std::min(offset, size);
+    job->startLine = line;
+    thread = std::thread(searchBuffer, job);
+}
+
+void BufferSearch::cancel() {
+    if (job) {
+        job->cancelled = true;
+        thread.join();  // the buffer may go away after this
+        job.reset();
+    }
+}
+
+const std::string &BufferSearch::pattern() const {
+    static const std::string none;
+    return job ? job->pattern : none;
+}
+
+int BufferSearch::progress() const {
+    if (!job || job->size == 0) {
+        return 100;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return (int)(job->scanned * 100 / job->size);
+}
+
+SearchStatus BufferSearch::next(uint64_t from, SearchHit &hit) const {
+    if (!job || job->size == 0) {
+        return SEARCH_NOT_FOUND;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (from >= job->size) {
+        from = 0;
+    }
+    uint64_t key = job->key(from);
+    auto found = std::lower_bound(job->hits.begin(), job->hits.end(), key, [&](const SearchHit &h, uint64_t k) {
+        return job->key(h.offset) < k;
+    });
+    if (found != job->hits.end()) {
+        hit = *found;
+        return SEARCH_FOUND;
+    }
+    if (!job->done) {
+        return SEARCH_PENDING;
+    }
+    if (job->hits.empty()) {
+        return SEARCH_NOT_FOUND;
+    }
+    hit = job->hits.front();  // wrapped around
+    return SEARCH_FOUND;
+}
+
+SearchStatus BufferSearch::previous(uint64_t before, SearchHit &hit) const {
+    if (!job || job->size == 0) {
+        return SEARCH_NOT_FOUND;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    uint64_t key = job->key(std::min(before, job->size - 1));
+    if (key > job->scanned && !job->done) {
+        return SEARCH_PENDING;  // there may be hits between the scan and before
+    }
+    auto found = std::lower_bound(job->hits.begin(), job->hits.end(), key, [&](const SearchHit &h, uint64_t k) {
+        return job->key(h.offset) < k;
+    });
+    if (found != job->hits.begin()) {
+        hit = *(found - 1);
+        return SEARCH_FOUND;
+    }
+    if (!job->done) {
+        return SEARCH_PENDING;
+    }
+    if (job->hits.empty()) {
+        return SEARCH_NOT_FOUND;
+    }
+    hit = job->hits.back();  // wrapped around
+    return SEARCH_FOUND;
+}
+
+// Files smaller than this are indexed quickly enough not to need a side cache
+static const uint64_t LINE_INDEX_CACHE_MIN_SIZE = 64ull << 20;
+
+// How much of a file prefetchFile() reads: a screenful, and the part of it
+// that the compression and binary checks look at
+static const uint64_t PREFETCH_FILE_BYTES = 64u << 10;
+
+void prefetchFile(const std::string &filePath) {
+    MappedFile file;
+    if (!file.open(filePath)) {
+        return;
+    }
+    // Touching a byte of each page makes the OS read it in
+    volatile char sink = 0;
+    uint64_t end = std::min(file.size(), PREFETCH_FILE_BYTES);
+    for (uint64_t offset = 0; offset < end; offset += 4096) {
+        sink = sink + file.data()[offset];
+    }
+    if (file.size() >= LINE_INDEX_CACHE_MIN_SIZE) {
+        LineIndex index;
+        index.reset(file.data(), file.size());
+        index.load(lineIndexCachePath(file.id()), file.id(), file.mtime());
+    }
+}
+
+// How often a followed file is checked for new data
+static const int FOLLOW_POLL_MS = 250;
+
+// How much of the file is indexed between progress updates on long jumps
+static const uint64_t SCAN_CHUNK = 64ull << 20;
+
+// Function to read a line of input on the bottom line; false if cancelled with ESC
+bool promptLine(const char *label, std::string &out) {
+    out.clear();
+    timeout(-1);
+    curs_set(1);
+    bool accepted = false;
+    while (true) {
+        move(LINES - 1, 0);
+        clrtoeol();
+        mvprintw(LINES - 1, 0, "%s%s", label, out.c_str());
+        int ch = getch();
+        if (ch == 10 || ch == KEY_ENTER) {
+            accepted = true;
+            break;
+        } else if (ch == 27) {
+            break;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (!out.empty()) {
+                out.pop_back();
+            }
+        } else if (ch >= 32 && ch < 256) {
+            out.push_back((char)ch);
+        }
+    }
+    curs_set(0);
+    return accepted;
+}
+
+// Columns of a tab stop
+static const uint64_t TAB_WIDTH = 8;
+
+// Function to draw columns [leftColumn, leftColumn + width) of a line at row,
+// from screen column screenColumn on, expanding tabs. Nothing past the right edge is looked at, so a huge line
+// costs no more than a short one. Control characters show as '.', and so do
+// bytes outside ASCII unless the locale is multibyte; out is scratch space
+// reused from line to line.
+void drawTextLine(int row, int screenColumn, std::string_view text, uint64_t leftColumn, int width, std::string &out) {
+    bool multibyte = MB_CUR_MAX > 1;
+    uint64_t rightColumn = leftColumn + (uint64_t)std::max(0, width);
+    uint64_t column = 0;
+    bool shown = false;  // whether the last character started on screen
+    out.clear();
+    for (size_t i = 0; i < text.size() && column < rightColumn; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\t') {
+            uint64_t stop = std::min((column / TAB_WIDTH + 1) * TAB_WIDTH, rightColumn);
+            for (; column < stop; column++) {
+                if (column >= leftColumn) {
+                    out.push_back(' ');
+                }
+            }
+            continue;
+        }
+        if (multibyte && (c & 0xC0) == 0x80) {
+            if (shown) {
+                out.push_back((char)c);  // continuation of a character already counted
+            }
+            continue;
+        }
+        shown = column >= leftColumn;
+        if (shown) {
+            out.push_back(c < 32 || c == 127 || (c >= 0x80 && !multibyte) ? '.' : (char)c);
+        }
+        column++;
+    }
+    mvaddnstr(row, screenColumn, out.data(), (int)out.size());
+}
+
+// Index up to targetLine (or the whole file), showing progress; false if cancelled with ESC
+static bool scanWithProgress(LineIndex &index, uint64_t targetLine, uint64_t fileSize) {
+    bool cancelled = false;
+    timeout(0);
+    while (!index.complete() && index.knownLines() <= targetLine) {
+        index.scanBytes(index.scannedBytes() + SCAN_CHUNK);
+
+        move(LINES - 1, 0);
+        clrtoeol();
+        mvprintw(LINES - 1, 0, "Indexing... %d%%  ESC to cancel",
+                 (int)(fileSize ? index.scannedBytes() * 100 / fileSize : 100));
+        refresh();
+        if (getch() == 27) {
+            cancelled = true;
+            break;
+        }
+    }
+    timeout(-1);
+    return !cancelled;
+}
+
+// Decode until lines [first, first + count) of a compressed file are in its
+// window, showing progress; false if cancelled with ESC
+static bool decodeWithProgress(CompressedText &text, uint64_t first, uint64_t count) {
+    bool cancelled = false;
+    timeout(0);
+    for (int steps = 0; !text.ready(first, count); steps++) {
+        text.step(first);
+        if (steps % 16 == 15) {
+            move(LINES - 1, 0);
+            clrtoeol();
+            mvprintw(LINES - 1, 0, "Decompressing... %d%%  ESC to cancel", text.progress());
+            refresh();
+            if (getch() == 27) {
+                cancelled = true;
+                break;
+            }
+        }
+    }
+    timeout(-1);
+    return !cancelled;
+}
+
+// Function to display a compressed file. It is decompressed as it is read,
+// into a window of bounded size, so only navigation is offered: no search or
+// follow mode.
+static void displayCompressedContent(const std::string &filePath, const MappedFile &file, Compression format) {
+    CompressedText text;
+    text.open(file.data(), file.size(), format);
+
+    uint64_t topLine = 0;
+    uint64_t currentLine = 0;
+    uint64_t leftColumn = 0;
+    std::vector<std::string_view> window;
+    std::string rowText;
+    std::string input;
+    bool quit = false;
+
+    while (!quit) {
+        uint64_t visibleRows = (uint64_t)std::max(1, LINES - 2);
+        if (!decodeWithProgress(text, topLine, visibleRows)) {
+            topLine = currentLine = 0;  // back to where nothing needs decoding
+            decodeWithProgress(text, 0, visibleRows);
+        }
+        uint64_t shownLines = text.lines(topLine, visibleRows, window);
+
+        erase();
+        mvprintw(0, 0, "File: %s (%s)", filePath.c_str(), compressionName(format));
+        for (uint64_t i = 0; i < shownLines; ++i) {
+            if (topLine + i == currentLine) {
+                attron(A_REVERSE);
+            }
+            drawTextLine((int)i + 1, 0, window[i], leftColumn, COLS, rowText);
+            if (topLine + i == currentLine) {
+                attroff(A_REVERSE);
+            }
+        }
+
+        char columnText[32] = "";
+        if (leftColumn > 0) {
+            snprintf(columnText, sizeof(columnText), ", column %llu", (unsigned long long)leftColumn + 1);
+        }
+        const char *help = "Arrows/PgUp/PgDn/Home/End to navigate, : to go to line, ESC to exit";
+        if (text.failed()) {
+            mvprintw(LINES - 1, 0, "Line %llu%s  Corrupt after this point  %s", (unsigned long long)currentLine + 1,
+                     columnText, help);
+        } else if (text.complete()) {
+            mvprintw(LINES - 1, 0, "Line %llu/%llu%s  %s", (unsigned long long)(text.knownLines() ? currentLine + 1 : 0),
+                     (unsigned long long)text.knownLines(), columnText, help);
+        } else {
+            mvprintw(LINES - 1, 0, "Line %llu%s  %s", (unsigned long long)currentLine + 1, columnText, help);
+        }
+
+        uint64_t targetLine = currentLine;
+        int ch = getch();
+        switch (ch) {
+        case KEY_UP:
+            if (currentLine > 0) {
+                targetLine = currentLine - 1;
+            }
+            break;
+        case KEY_DOWN:
+            targetLine = currentLine + 1;
+            break;
+        case KEY_PPAGE:
+            targetLine = currentLine > visibleRows ? currentLine - visibleRows : 0;
+            topLine = topLine > visibleRows ? topLine - visibleRows : 0;
+            break;
+        case KEY_NPAGE:
+            targetLine = currentLine + visibleRows;
+            topLine += visibleRows;
+            break;
+        case KEY_LEFT:
+            leftColumn -= std::min(leftColumn, (uint64_t)std::max(1, COLS / 2));
+            break;
+        case KEY_RIGHT:
+            leftColumn += (uint64_t)std::max(1, COLS / 2);
+            break;
+        case KEY_HOME:
+            targetLine = 0;
+            break;
+        case KEY_END:
+            if (decodeWithProgress(text, UINT64_MAX - 1, 1)) {
+                targetLine = UINT64_MAX;
+            }
+            break;
+        case ':':
+            if (promptLine("Go to line: ", input)) {
+                uint64_t line = strtoull(input.c_str(), nullptr, 10);
+                if (line > 0 && decodeWithProgress(text, line - 1, 1)) {
+                    targetLine = line - 1;
+                }
+            }
+            break;
+        case 27:  // ESC key to exit
+            quit = true;
+            break;
+        }
+
+        // Clamp to the lines that exist and keep the cursor on screen
+        if (targetLine > currentLine && !decodeWithProgress(text, std::min(targetLine, UINT64_MAX - 1), 1)) {
+            targetLine = currentLine;
+        }
+        uint64_t knownLines = text.knownLines();
+        if (text.complete()) {
+            targetLine = knownLines ? std::min(targetLine, knownLines - 1) : 0;
+            topLine = knownLines > visibleRows ? std::min(topLine, knownLines - visibleRows) : 0;
+        } else if (targetLine >= knownLines) {
+            targetLine = knownLines ? knownLines - 1 : 0;  // the rest of a line longer than the window
+        }
+        currentLine = targetLine;
+        if (currentLine < topLine) {
+            topLine = currentLine;
+        }
+        if (currentLine >= topLine + visibleRows) {
+            topLine = currentLine - visibleRows + 1;
+        }
+    }
+}
+
+// Bytes per row of the hex view
+static const uint64_t HEX_ROW_BYTES = 16;
+
+// Function to display a binary file as a hex dump. Rows are formatted straight
+// from the mapping, so only the pages on screen are ever read.
+static void displayHexContent(const std::string &filePath, const MappedFile &file) {
+    const unsigned char *data = (const unsigned char *)file.data();
+    uint64_t size = file.size();
+    uint64_t rows = (size + HEX_ROW_BYTES - 1) / HEX_ROW_BYTES;
+    int offsetDigits = size > 0xffffffffULL ? 16 : 8;
+
+    uint64_t topRow = 0;
+    uint64_t currentRow = 0;
+    std::string input;
+    bool quit = false;
+
+    while (!quit) {
+        uint64_t visibleRows = (uint64_t)std::max(1, LINES - 2);
+
+        erase();
+        mvprintw(0, 0, "File: %s (binary)", filePath.c_str());
+        for (uint64_t i = 0; i < visibleRows && topRow + i < rows; i++) {
+            uint64_t offset = (topRow + i) * HEX_ROW_BYTES;
+            uint64_t count = std::min(HEX_ROW_BYTES, size - offset);
+
+            // offset, then the bytes in hex in two groups of eight, then as text
+            char row[128];
+            int length = snprintf(row, sizeof(row), "%0*llx  ", offsetDigits, (unsigned long long)offset);
+            for (uint64_t j = 0; j < HEX_ROW_BYTES; j++) {
+                if (j < count) {
+                    length += snprintf(row + length, sizeof(row) - length, "%02x ", data[offset + j]);
+                } else {
+                    length += snprintf(row + length, sizeof(row) - length, "   ");
+                }
+                if (j == HEX_ROW_BYTES / 2 - 1) {
+                    row[length++] = ' ';
+                }
+            }
+            row[length++] = ' ';
+            row[length++] = '|';
+            for (uint64_t j = 0; j < count; j++) {
+                unsigned char c = data[offset + j];
+                row[length++] = c >= 32 && c < 127 ? (char)c : '.';
+            }
+            row[length++] = '|';
+
+            if (topRow + i == currentRow) {
+                attron(A_REVERSE);
+            }
+            mvaddnstr((int)i + 1, 0, row, std::min(length, COLS));
+            if (topRow + i == currentRow) {
+                attroff(A_REVERSE);
+            }
+        }
+        mvprintw(LINES - 1, 0, "Offset 0x%llx/0x%llx  Arrows/PgUp/PgDn/Home/End to navigate, : to go to offset, ESC to exit",
+                 (unsigned long long)(currentRow * HEX_ROW_BYTES), (unsigned long long)size);
+
+        uint64_t targetRow = currentRow;
+        int ch = getch();
+        switch (ch) {
+        case KEY_UP:
+            if (currentRow > 0) {
+                targetRow = currentRow - 1;
+            }
+            break;
+        case KEY_DOWN:
+            targetRow = currentRow + 1;
+            break;
+        case KEY_PPAGE:
+            targetRow = currentRow > visibleRows ? currentRow - visibleRows : 0;
+            topRow = topRow > visibleRows ? topRow - visibleRows : 0;
+            break;
+        case KEY_NPAGE:
+            targetRow = currentRow + visibleRows;
+            topRow += visibleRows;
+            break;
+        case KEY_HOME:
+            targetRow = 0;
+            break;
+        case KEY_END:
+            targetRow = UINT64_MAX;
+            break;
+        case ':':
+            // Decimal, or hex with 0x in front
+            if (promptLine("Go to offset: ", input) && !input.empty()) {
+                targetRow = strtoull(input.c_str(), nullptr, 0) / HEX_ROW_BYTES;
+                topRow = targetRow;
+            }
+            break;
+        case 27:  // ESC key to exit
+            quit = true;
+            break;
+        }
+
+        // Clamp to the rows that exist and keep the cursor on screen
+        currentRow = rows ? std::min(targetRow, rows - 1) : 0;
+        topRow = rows > visibleRows ? std::min(topRow, rows - visibleRows) : 0;
+        if (currentRow < topRow) {
+            topRow = currentRow;
+        }
+        if (currentRow >= topRow + visibleRows) {
+            topRow = currentRow - visibleRows + 1;
+        }
+    }
+}
+
+// Function to clear the screen and wait for a key before going back to the directory view
+static void waitBeforeReturning() {
+    erase();
+    mvprintw(0, 0, "Returning to directory view...");
+    refresh();
+    getch();  // Wait for user input before exiting
+}
+
+// Function to display file content with scrollable functionality. The file is
+// memory mapped and lines are only indexed as far as the view has reached, so
+// the time to the first screen doesn't depend on the file size.
+void displayFileContent(const std::string &filePath, uint64_t startLine) {
+    timeout(-1);  // the directory loop may have left input non-blocking
+
+    MappedFile file;
+    if (!file.open(filePath)) {
+        mvprintw(0, 0, "Error: Unable to open file");
+        return;
+    }
+
+    // Compressed files get a viewer of their own, over the decompressed text,
+    // and other binary files are shown as a hex dump
+    Compression format = detectCompression(file.data(), file.size());
+    if (format != COMPRESSION_NONE) {
+        displayCompressedContent(filePath, file, format);
+        waitBeforeReturning();
+        return;
+    }
+    if (looksBinary(file.data(), file.size())) {
+        displayHexContent(filePath, file);
+        waitBeforeReturning();
+        return;
+    }
+
+    LineIndex index;
+    index.reset(file.data(), file.size());
+
+    // Reuse the checkpoints from an earlier visit to a big file
+    std::string cachePath;
+    uint64_t cachedBytes = 0;
+    if (file.size() >= LINE_INDEX_CACHE_MIN_SIZE) {
+        cachePath = lineIndexCachePath(file.id());
+        if (index.load(cachePath, file.id(), file.mtime())) {
+            cachedBytes = index.scannedBytes();
+        }
+    }
+
+    uint64_t topLine = 0;  // The first visible line
+    uint64_t currentLine = 0;  // The line the cursor is currently on
+    std::vector<uint64_t> window;  // Start offsets of the visible lines
+    uint64_t windowTop = UINT64_MAX;  // the topLine and row count window was resolved for
+    uint64_t windowRows = 0;
+    uint64_t shownLines = 0;
+    uint64_t leftColumn = 0;  // first column shown, for scrolling sideways
+    std::string rowText;  // scratch for drawing
+    std::string input;
+
+    // Start on the requested line, a third of the way down the screen
+    if (startLine > 0 && scanWithProgress(index, startLine, file.size())) {
+        uint64_t knownLines = index.knownLines();
+        currentLine = knownLines ? std::min(startLine, knownLines - 1) : 0;
+        topLine = currentLine - std::min(currentLine, (uint64_t)std::max(0, LINES - 2) / 3);
+    }
+
+    // Search state: the hits are kept across n/N; pendingSearch is a lookup
+    // waiting for the background scan to get far enough
+    BufferSearch search;
+    enum { SEARCH_IDLE, SEARCH_NEXT, SEARCH_PREVIOUS } pendingSearch = SEARCH_IDLE;
+    uint64_t searchFrom = 0;
+    std::string message;  // shown on the status line until the next key
+    bool following = false;  // F: keep the end of a growing file on screen
+
+    // Start offset of a line, or the end of the file past the last one
+    auto lineStart = [&](uint64_t line) {
+        std::vector<uint64_t> starts;
+        return index.resolve(line, 1, starts) ? starts[0] : file.size();
+    };
+
+    int ch;
+    bool quit = false;
+
+    while (!quit) {
+        uint64_t visibleRows = (uint64_t)std::max(1, LINES - 2);  // Subtract 2 for file name and status line
+        if (topLine != windowTop || visibleRows != windowRows) {
+            // Only resolved again when the view moves: finding where a very long line ends is a full scan of it
+            shownLines = index.resolve(topLine, visibleRows, window);
+            windowTop = topLine;
+            windowRows = visibleRows;
+        }
+
+        erase();
+
+        // Display file name at the top
+        mvprintw(0, 0, "File: %s", filePath.c_str());
+
+        // Display the visible portion of the file
+        for (uint64_t i = 0; i < shownLines; ++i) {
+            if (topLine + i == currentLine) {
+                attron(A_REVERSE);  // Highlight the current line
+            }
+            drawTextLine((int)i + 1, 0, index.text(window[i], window[i + 1]), leftColumn, COLS, rowText);
+            if (topLine + i == currentLine) {
+                attroff(A_REVERSE);
+            }
+        }
+
+        // Display position and navigation instructions at the bottom
+        if (following) {
+            mvprintw(LINES - 1, 0, "Following, line %llu  Any key to stop", (unsigned long long)index.knownLines());
+        } else if (pendingSearch != SEARCH_IDLE) {
+            mvprintw(LINES - 1, 0, "Searching for \"%s\"... %d%%  ESC to stop waiting", search.pattern().c_str(),
+                     search.progress());
+        } else if (!message.empty()) {
+            mvprintw(LINES - 1, 0, "%s", message.c_str());
+        } else {
+            char columnText[32] = "";
+            if (leftColumn > 0) {
+                snprintf(columnText, sizeof(columnText), ", column %llu", (unsigned long long)leftColumn + 1);
+            }
+            const char *help = "Arrows/PgUp/PgDn/Home/End to navigate, : to go to line, / to search, F to follow, ESC to exit";
+            if (index.complete()) {
+                mvprintw(LINES - 1, 0, "Line %llu/%llu%s  %s", (unsigned long long)(index.knownLines() ? currentLine + 1 : 0),
+                         (unsigned long long)index.knownLines(), columnText, help);
+            } else {
+                mvprintw(LINES - 1, 0, "Line %llu%s  %s", (unsigned long long)currentLine + 1, columnText, help);
+            }
+        }
+
+        // Handle user input, checking on a search being waited for meanwhile
+        uint64_t targetLine = currentLine;
+        timeout(pendingSearch != SEARCH_IDLE ? SEARCH_POLL_MS : following ? FOLLOW_POLL_MS : -1);
+        ch = getch();
+        if (ch != ERR) {
+            message.clear();
+        }
+        if (following && ch != ERR && ch != KEY_RESIZE) {
+            // Any key stops following; ESC and F do nothing else
+            following = false;
+            if (ch == 27 || ch == 'F') {
+                ch = ERR;
+            }
+        }
+        switch (ch) {
+        case KEY_UP:
+            if (currentLine > 0) {
+                targetLine = currentLine - 1;
+            }
+            break;
+        case KEY_DOWN:
+            targetLine = currentLine + 1;
+            break;
+        case KEY_PPAGE:
+            targetLine = currentLine > visibleRows ? currentLine - visibleRows : 0;
+            topLine = topLine > visibleRows ? topLine - visibleRows : 0;
+            break;
+        case KEY_NPAGE:
+            targetLine = currentLine + visibleRows;
+            topLine += visibleRows;
+            break;
+        case KEY_LEFT:
+            leftColumn -= std::min(leftColumn, (uint64_t)std::max(1, COLS / 2));
+            break;
+        case KEY_RIGHT:
+            leftColumn += (uint64_t)std::max(1, COLS / 2);
+            break;
+        case KEY_HOME:
+            targetLine = 0;
+            break;
+        case KEY_END:
+            if (scanWithProgress(index, UINT64_MAX, file.size())) {
+                targetLine = UINT64_MAX;
+            }
+            break;
+        case ':':
+            if (promptLine("Go to line: ", input)) {
+                uint64_t line = strtoull(input.c_str(), nullptr, 10);
+                if (line > 0 && scanWithProgress(index, line - 1, file.size())) {
+                    targetLine = line - 1;
+                }
+            }
+            break;
+        case '/':
+            if (promptLine("/", input) && !input.empty()) {
+                // A new pattern starts a scan at the current line; the same one reuses its hits
+                searchFrom = lineStart(currentLine);
+                if (input != search.pattern()) {
+                    search.start(file.data(), file.size(), input, searchFrom, currentLine);
+                }
+                pendingSearch = SEARCH_NEXT;
+            }
+            break;
+        case 'n':
+        case 'N':
+            if (!search.active()) {
+                message = "No search yet: / to search";
+            } else if (ch == 'n') {
+                searchFrom = lineStart(currentLine + 1);
+                pendingSearch = SEARCH_NEXT;
+            } else {
+                searchFrom = lineStart(currentLine);
+                pendingSearch = SEARCH_PREVIOUS;
+            }
+            break;
+        case 'F':
+            if (scanWithProgress(index, UINT64_MAX, file.size())) {
+                following = true;
+            }
+            break;
+        case KEY_RESIZE:
+            break;
+        case 27:  // ESC key to exit
+            if (pendingSearch != SEARCH_IDLE) {
+                pendingSearch = SEARCH_IDLE;  // the scan carries on; n picks up its hits
+                break;
+            }
+            quit = true;
+            break;
+        }
+
+        if (pendingSearch != SEARCH_IDLE) {
+            SearchHit hit;
+            SearchStatus status = pendingSearch == SEARCH_NEXT ? search.next(searchFrom, hit)
+                                                               : search.previous(searchFrom, hit);
+            if (status == SEARCH_FOUND) {
+                pendingSearch = SEARCH_IDLE;
+                if (scanWithProgress(index, hit.line, file.size())) {
+                    targetLine = hit.line;
+                }
+            } else if (status == SEARCH_NOT_FOUND) {
+                pendingSearch = SEARCH_IDLE;
+                message = "Not found: " + search.pattern();
+            }
+        }
+
+        // Pick up what has been written to a followed file since the last
+        // look, and start over on a file that was truncated, followed or not:
+        // what was past its new end now reads as NUL bytes
+        FileChange change = file.changed();
+        if (change == FILE_SHRUNK || (following && change == FILE_GROWN)) {
+            std::string pattern = search.pattern();
+            search.cancel();  // it reads the mapping that is about to move
+            if (change == FILE_GROWN && file.remap()) {
+                index.extend(file.data(), file.size());
+            } else if (change == FILE_SHRUNK) {
+                // Truncated, as by copytruncate log rotation
+                if (!file.open(filePath)) {
+                    following = false;
+                    message = "Error: Unable to reopen file";
+                } else if (!following) {
+                    message = "The file was truncated, and has been read again";
+                }
+                index.reset(file.data(), file.size());
+                cachedBytes = 0;
+                topLine = 0;
+            }
+            if (following) {
+                index.scanTo(UINT64_MAX);  // only the new part
+            }
+            windowTop = UINT64_MAX;
+            if (!pattern.empty()) {
+                uint64_t line = following && index.knownLines() ? index.knownLines() - 1 : 0;
+                search.start(file.data(), file.size(), pattern, lineStart(line), line);
+            }
+        }
+        if (following) {
+            targetLine = UINT64_MAX;
+        }
+
+        // Clamp to the lines that exist and keep the cursor on screen
+        index.scanTo(std::min(targetLine, UINT64_MAX - 1) + 1);
+        uint64_t knownLines = index.knownLines();
+        currentLine = knownLines ? std::min(targetLine, knownLines - 1) : 0;
+        if (index.complete() && knownLines > visibleRows) {
+            topLine = std::min(topLine, knownLines - visibleRows);
+        } else if (index.complete()) {
+            topLine = 0;
+        }
+        if (currentLine < topLine) {
+            topLine = currentLine;
+        }
+        if (currentLine >= topLine + visibleRows) {
+            topLine = currentLine - visibleRows + 1;
+        }
+    }
+
+    search.cancel();
+
+    // Keep the work for next time if the scan got further than the cache
+    if (!cachePath.empty() && index.scannedBytes() > cachedBytes) {
+        index.save(cachePath, file.id(), file.mtime());
+    }
+
+    // Wait for user input to return to the directory view
+    waitBeforeReturning();
+}
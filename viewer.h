@@ -0,0 +1,190 @@
+#ifndef VIEWER_H_INCLUDED
+#define VIEWER_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum FileChange {
+    FILE_UNCHANGED,
+    FILE_GROWN,   // appended to; remap() picks up the new data
+    FILE_SHRUNK   // truncated or rewritten; open it again
+};
+
+// Read-only memory mapping of a whole file. Nothing is read up front; the
+// OS pages in only the parts of the file that are actually touched.
+// If the file is truncated meanwhile, the part past its new end reads as
+// NUL bytes rather than raising SIGBUS; changed() tells that it shrank.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    // How the open file's size compares to what is mapped
+    FileChange changed() const;
+
+    // Extend the mapping over whatever has been appended since it was made.
+    // data() may move, so nothing may be reading the old mapping meanwhile.
+    bool remap();
+
+    const char *data() const { return base; }
+    uint64_t size() const { return length; }
+
+    // Identity of the open file, for keying caches: device and inode (volume
+    // serial and file index on Windows) folded together, and the mtime
+    uint64_t id() const { return fileId; }
+    int64_t mtime() const { return modifiedTime; }
+
+private:
+    const char *base = nullptr;
+    uint64_t length = 0;
+    uint64_t fileId = 0;
+    int64_t modifiedTime = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;     // HANDLE
+    void *mappingHandle = nullptr;  // HANDLE
+#else
+    int fd = -1;
+    int guardSlot = -1;  // where the mapping is registered for the SIGBUS handler
+#endif
+};
+
+// Sparse line index over a mapped buffer. Only the start of every
+// CHECKPOINT_LINES-th line is stored; exact positions are resolved by scanning
+// forward from the nearest checkpoint, so jumping anywhere in the part of the
+// file that has been scanned costs at most one checkpoint interval.
+class LineIndex {
+public:
+    static const uint64_t CHECKPOINT_LINES = 1024;
+
+    void reset(const char *data, uint64_t size);
+
+    // Carry on over a buffer that has grown: the same bytes, maybe moved, with
+    // more after them. Only the new part is scanned.
+    void extend(const char *data, uint64_t size);
+
+    // Scan forward until the start of line `line` is known or the end is reached
+    void scanTo(uint64_t line);
+
+    // Scan forward until at least `offset` bytes of the buffer have been indexed
+    void scanBytes(uint64_t offset);
+
+    bool complete() const { return done; }
+    uint64_t scannedBytes() const { return frontierOffset; }
+
+    // Number of lines known so far; the total once complete()
+    uint64_t knownLines() const { return done ? totalLines : frontierLine; }
+
+    // Resolve the start offsets of lines [first, first + count). starts receives
+    // one more offset than the number of lines returned: the end of the last one.
+    uint64_t resolve(uint64_t first, uint64_t count, std::vector<uint64_t> &starts);
+
+    // Text between two offsets from resolve(), without the line terminator
+    std::string_view text(uint64_t begin, uint64_t end) const;
+
+    // Side cache of the checkpoints, keyed by file identity
+    bool load(const std::string &cachePath, uint64_t fileId, int64_t mtime);
+    bool save(const std::string &cachePath, uint64_t fileId, int64_t mtime) const;
+
+private:
+    void advance(uint64_t k);
+
+    const char *data = nullptr;
+    uint64_t size = 0;
+    std::vector<uint64_t> checkpoints;  // checkpoints[i] is the start of line i * CHECKPOINT_LINES
+    uint64_t frontierLine = 0;          // lines before this one have been scanned...
+    uint64_t frontierOffset = 0;        // ...and this is where it starts
+    uint64_t totalLines = 0;
+    bool done = true;
+};
+
+// A hit of a BufferSearch: where it is and on which line
+struct SearchHit {
+    uint64_t offset;
+    uint64_t line;  // 0 based
+};
+
+enum SearchStatus {
+    SEARCH_FOUND,
+    SEARCH_PENDING,   // the part of the buffer that decides hasn't been scanned yet
+    SEARCH_NOT_FOUND
+};
+
+struct SearchJob;
+
+// Finds the lines of a buffer that contain a string, on a background thread.
+// The scan starts at a given line and wraps around at the end of the buffer,
+// and every hit found is kept, so stepping from one hit to the next never
+// scans anything twice.
+class BufferSearch {
+public:
+    ~BufferSearch();
+
+    // Start looking for pattern from offset, the start of line `line`,
+    // cancelling any earlier search. data must outlive the search.
+    void start(const char *data, uint64_t size, const std::string &pattern, uint64_t offset, uint64_t line);
+
+    // Stop the search and wait for its thread to exit
+    void cancel();
+
+    bool active() const { return job != nullptr; }
+    const std::string &pattern() const;
+
+    // How much of the buffer has been scanned, in percent
+    int progress() const;
+
+    // First hit at or after offset from, wrapping around at the end
+    SearchStatus next(uint64_t from, SearchHit &hit) const;
+
+    // Last hit before offset before, wrapping around at the start
+    SearchStatus previous(uint64_t before, SearchHit &hit) const;
+
+private:
+    std::shared_ptr<SearchJob> job;
+    std::thread thread;
+};
+
+// Directory for side caches, created if need be; "" if there is nowhere to put one
+std::string cacheDirectory();
+
+// Path of the line index side cache for a file, or "" if there is no cache directory
+std::string lineIndexCachePath(uint64_t fileId);
+
+// Function to bring what displayFileContent() reads first from a file into
+// the OS cache: its first page, and the line index side cache of a big file
+void prefetchFile(const std::string &filePath);
+
+// Function to check if the file is readable
+bool isReadable(const std::string &filePath);
+
+// Function to open the file with the default application, returning right
+// away. False, with error set, if it couldn't be started at all; if it fails
+// later on that is reported by takeLaunchFailure().
+bool openWithDefaultApplication(const std::string &filePath, std::string &error);
+
+// Message about an application that exited with an error since the last
+// call, or "" if none did
+std::string takeLaunchFailure();
+
+// Function to draw columns [leftColumn, leftColumn + width) of a line of
+// text at row, from screen column screenColumn on. Tabs are expanded and
+// control characters shown as '.'; out is scratch space.
+void drawTextLine(int row, int screenColumn, std::string_view text, uint64_t leftColumn, int width,
+                  std::string &out);
+
+// Function to read a line of input on the bottom line; false if cancelled with ESC
+bool promptLine(const char *label, std::string &out);
+
+// Function to display file content with scrollable functionality, starting
+// at line startLine (0 based). The file must be readable: see isReadable().
+void displayFileContent(const std::string &filePath, uint64_t startLine = 0);
+
+#endif // VIEWER_H_INCLUDED
@@ -0,0 +1,422 @@
+#include "walker.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "events.h"
+#include "listing.h"
+#include "trace.h"
+#include "treeindex.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+#define FIND_FIRST_EX_LARGE_FETCH 2  // Windows 7 and later
+#endif
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// A directory waiting to be read
+struct WalkTask {
+    std::string path;
+    uint32_t root;
+    int depth;     // 0 for the roots themselves
+    uint64_t dev;  // device of the root, once known
+};
+
+// One worker's deque. The owner pushes and pops at the back; thieves take
+// from the front, which holds the shallowest, and so biggest, subtrees.
+struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<WalkTask> tasks;
+};
+
+struct WalkShared {
+    const WalkOptions &options;
+    const WalkVisitor &visit;
+    const std::atomic<bool> &cancelled;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::atomic<int64_t> pending{0};  // tasks queued or being worked on
+    std::mutex idleMutex;
+    std::condition_variable idle;
+#ifdef HAVE_TRACE
+    std::atomic<uint64_t> visited{0};
+#endif
+
+    WalkShared(const WalkOptions &options, const WalkVisitor &visit, const std::atomic<bool> &cancelled)
+        : options(options), visit(visit), cancelled(cancelled) {}
+};
+
+unsigned walkerThreads() {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    return std::min(32u, std::max(4u, cores * 2));
+}
+
+static void pushTask(WalkShared &shared, size_t worker, WalkTask &&task) {
+    shared.pending++;
+    {
+        std::lock_guard<std::mutex> lock(shared.queues[worker]->mutex);
+        shared.queues[worker]->tasks.push_back(std::move(task));
+    }
+    shared.idle.notify_one();
+}
+
+static bool takeTask(WalkShared &shared, size_t worker, WalkTask &task) {
+    {
+        WorkerQueue &own = *shared.queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < shared.queues.size(); i++) {
+        WorkerQueue &victim = *shared.queues[(worker + i) % shared.queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Report one entry and queue it if it is a directory to descend into
+static void visitEntry(WalkShared &shared, size_t worker, const WalkTask &task, WalkEntry &entry) {
+    entry.dirPath = &task.path;
+    entry.depth = task.depth + 1;
+    entry.root = task.root;
+#ifdef HAVE_TRACE
+    shared.visited.fetch_add(1, std::memory_order_relaxed);
+#endif
+    shared.visit(entry);
+
+    int maxDepth = shared.options.maxDepth;
+    if (entry.type == ENTRY_DIR && (maxDepth < 0 || entry.depth < maxDepth)) {
+        std::string child;
+        child.reserve(task.path.size() + 1 + entry.nameLength);
+        child.append(task.path).push_back('/');
+        child.append(entry.name, entry.nameLength);
+        pushTask(shared, worker, WalkTask{std::move(child), task.root, entry.depth, task.dev});
+    }
+}
+
+static bool isDotOrDotDot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+#ifdef _WIN32
+// Windows: FindFirstFileEx returns sizes and times along with the names,
+// without the short names and in big buffers, as in getDirectoryContents()
+static void readDirectory(WalkShared &shared, size_t worker, WalkTask &task) {
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileExA((task.path + "\\*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+        if (shared.options.onError) {
+            DWORD error = GetLastError();
+            shared.options.onError(task.path, error == ERROR_ACCESS_DENIED ? EACCES
+                                              : error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND ? ENOENT
+                                                                                                              : EIO);
+        }
+        return;
+    }
+    do {
+        if (isDotOrDotDot(data.cFileName)) {
+            continue;
+        }
+        WalkEntry entry = {};
+        entry.name = data.cFileName;
+        entry.nameLength = strlen(data.cFileName);
+        bool isDir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        bool isLink = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;  // junctions and links
+        entry.type = isLink ? ENTRY_LINK : isDir ? ENTRY_DIR : ENTRY_FILE;
+        entry.hasStat = true;
+        entry.nlink = 1;
+        entry.mode = isDir ? S_IFDIR : S_IFREG;
+        entry.size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        ULARGE_INTEGER writeTime;
+        writeTime.LowPart = data.ftLastWriteTime.dwLowDateTime;
+        writeTime.HighPart = data.ftLastWriteTime.dwHighDateTime;
+        entry.mtime = (int64_t)((writeTime.QuadPart - 116444736000000000ULL) / 10000000ULL);
+        entry.mtimeNs = (int64_t)writeTime.QuadPart * 100;
+        entry.ctimeNs = entry.mtimeNs;
+        visitEntry(shared, worker, task, entry);
+    } while (!shared.cancelled && FindNextFileA(find, &data));
+    FindClose(find);
+}
+#else
+static void reportError(WalkShared &shared, const WalkTask &task, int error) {
+    if (shared.options.onError) {
+        shared.options.onError(task.path, error);
+    }
+}
+
+// Unix-like systems: read names straight from the directory descriptor and
+// stat relative to it
+static void visitName(WalkShared &shared, size_t worker, WalkTask &task, int dirFd, const char *name,
+                      unsigned char dType) {
+    if (isDotOrDotDot(name)) {
+        return;
+    }
+    WalkEntry entry = {};
+    entry.name = name;
+    entry.nameLength = strlen(name);
+    entry.type = typeFromDirent(dType);
+
+    if (shared.options.statEntries || entry.type == ENTRY_UNKNOWN) {
+        TraceTimer statTimer(TRACE_STAT);
+        struct stat fileStat;
+        if (fstatat(dirFd, name, &fileStat, AT_SYMLINK_NOFOLLOW) == 0) {
+            entry.type = typeFromMode(fileStat.st_mode);
+            entry.hasStat = true;
+            entry.dev = (uint64_t)fileStat.st_dev;
+            entry.ino = (uint64_t)fileStat.st_ino;
+            entry.nlink = (uint32_t)fileStat.st_nlink;
+            entry.mode = fileStat.st_mode;
+            entry.size = fileStat.st_size;
+            entry.mtime = fileStat.st_mtime;
+            stampFromStat(fileStat, entry.mtimeNs, entry.ctimeNs);
+        }
+    }
+    visitEntry(shared, worker, task, entry);
+}
+
+// List a directory from the index, if it is there and hasn't changed since.
+// One stat of the directory instead of reading it and statting its entries.
+static bool visitIndexed(WalkShared &shared, size_t worker, WalkTask &task, const struct stat &dirStat) {
+    int64_t mtime, ctime;
+    stampFromStat(dirStat, mtime, ctime);
+    const IndexDirectory *dir = shared.options.index->directory(task.path, mtime, ctime);
+    if (!dir) {
+        return false;
+    }
+    for (uint32_t i = 0; i < dir->entryCount && !shared.cancelled; i++) {
+        const IndexEntry &indexed = shared.options.index->entry(*dir, i);
+        WalkEntry entry = {};
+        entry.name = shared.options.index->name(*dir, indexed);
+        entry.nameLength = indexed.nameLength;
+        entry.type = indexed.type;
+        entry.hasStat = true;
+        entry.dev = (uint64_t)dirStat.st_dev;
+        entry.ino = indexed.ino;
+        entry.nlink = indexed.nlink;
+        entry.mode = indexed.mode;
+        entry.size = indexed.size;
+        entry.mtime = indexed.mtime;
+        visitEntry(shared, worker, task, entry);
+    }
+    return true;
+}
+
+static void readDirectory(WalkShared &shared, size_t worker, WalkTask &task) {
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (task.depth > 0 ? O_NOFOLLOW : 0);
+    int dirFd = open(task.path.c_str(), flags);
+    if (dirFd < 0) {
+        reportError(shared, task, errno);
+        return;
+    }
+
+    struct stat dirStat;
+    if (fstat(dirFd, &dirStat) == 0) {
+        if (task.depth == 0) {
+            task.dev = (uint64_t)dirStat.st_dev;
+        } else if (shared.options.oneFileSystem && (uint64_t)dirStat.st_dev != task.dev) {
+            close(dirFd);  // a mount point: reported, but not descended into
+            return;
+        }
+        if (shared.options.index && visitIndexed(shared, worker, task, dirStat)) {
+            close(dirFd);
+            return;
+        }
+    }
+
+#ifdef __linux__
+    // getdents64 with a big buffer: far fewer round trips than readdir on network mounts
+    static thread_local std::vector<char> buffer(256 * 1024);
+    while (!shared.cancelled) {
+        long length = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+        if (length < 0) {
+            reportError(shared, task, errno);
+        }
+        if (length <= 0) {
+            break;
+        }
+        for (long offset = 0; offset < length && !shared.cancelled;) {
+            const struct dirent64 *ent = (const struct dirent64 *)(buffer.data() + offset);
+            offset += ent->d_reclen;
+            visitName(shared, worker, task, dirFd, ent->d_name, ent->d_type);
+        }
+    }
+    close(dirFd);
+#else
+    DIR *dir = fdopendir(dirFd);
+    if (!dir) {
+        reportError(shared, task, errno);
+        close(dirFd);
+        return;
+    }
+    while (!shared.cancelled) {
+        errno = 0;  // readdir() only sets it on errors, not at the end
+        struct dirent *ent = readdir(dir);
+        if (!ent) {
+            if (errno != 0) {
+                reportError(shared, task, errno);
+            }
+            break;
+        }
+        visitName(shared, worker, task, dirFd, ent->d_name, ent->d_type);
+    }
+    closedir(dir);
+#endif
+}
+#endif
+
+static void walkWorker(WalkShared &shared, size_t worker) {
+    while (!shared.cancelled) {
+        WalkTask task;
+        if (!takeTask(shared, worker, task)) {
+            if (shared.pending == 0) {
+                break;  // nothing queued anywhere and nobody left to queue more
+            }
+            std::unique_lock<std::mutex> lock(shared.idleMutex);
+            shared.idle.wait_for(lock, std::chrono::milliseconds(1));
+            continue;
+        }
+        readDirectory(shared, worker, task);
+        if (--shared.pending == 0) {
+            shared.idle.notify_all();
+        }
+    }
+}
+
+void walkTrees(const std::vector<std::string> &roots, const WalkOptions &options, const WalkVisitor &visit,
+               const std::atomic<bool> &cancelled) {
+    TraceTimer timer(TRACE_WALK, roots.empty() ? std::string_view() : std::string_view(roots[0]));
+    WalkShared shared(options, visit, cancelled);
+    size_t threads = options.threads ? options.threads : walkerThreads();
+    for (size_t i = 0; i < threads; i++) {
+        shared.queues.emplace_back(new WorkerQueue);
+    }
+    for (size_t i = 0; i < roots.size(); i++) {
+        pushTask(shared, i % threads, WalkTask{roots[i], (uint32_t)i, 0, 0});
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back(walkWorker, std::ref(shared), i);
+    }
+    walkWorker(shared, 0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+#ifdef HAVE_TRACE
+    timer.setItems(shared.visited);
+#endif
+}
+
+// Hard linked files seen so far, sharded so the walkers rarely contend
+static const size_t INODE_SHARDS = 64;
+
+struct InodeShard {
+    std::mutex mutex;
+    std::set<std::pair<uint64_t, uint64_t>> seen;  // (dev, ino)
+};
+
+struct SizeJob {
+    std::string dirPath;
+    std::vector<std::string> names;
+    std::shared_ptr<const TreeIndex> index;
+    std::unique_ptr<std::atomic<int64_t>[]> totals;
+    InodeShard inodes[INODE_SHARDS];
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false};
+};
+
+// True the first time a (dev, ino) pair is seen
+static bool firstLink(SizeJob &job, uint64_t dev, uint64_t ino) {
+    InodeShard &shard = job.inodes[(ino ^ (dev * 31)) % INODE_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.seen.insert(std::make_pair(dev, ino)).second;
+}
+
+static void sizeTrees(std::shared_ptr<SizeJob> job) {
+    std::vector<std::string> roots;
+    for (const std::string &name : job->names) {
+        roots.push_back(job->dirPath + "/" + name);
+    }
+
+    WalkOptions options;
+    options.statEntries = true;
+    options.index = job->index.get();
+    walkTrees(roots, options, [&](const WalkEntry &entry) {
+        if (!entry.hasStat || entry.type == ENTRY_DIR) {
+            return;
+        }
+        if (entry.nlink > 1 && !firstLink(*job, entry.dev, entry.ino)) {
+            return;  // already counted through another link
+        }
+        job->totals[entry.root] += entry.size;
+    }, job->cancelled);
+
+    job->finished = true;
+    wakeUi();
+}
+
+DirSizer::~DirSizer() {
+    cancel();
+}
+
+void DirSizer::start(const std::string &dirPath, const std::vector<std::string> &names,
+                     std::shared_ptr<const TreeIndex> index) {
+    cancel();
+    job = std::make_shared<SizeJob>();
+    job->dirPath = dirPath;
+    job->names = names;
+    job->index = std::move(index);
+    job->totals.reset(new std::atomic<int64_t>[names.size()]);
+    for (size_t i = 0; i < names.size(); i++) {
+        job->totals[i] = 0;
+    }
+    std::thread(sizeTrees, job).detach();
+}
+
+void DirSizer::cancel() {
+    if (job) {
+        job->cancelled = true;
+        job.reset();
+    }
+}
+
+bool DirSizer::finished() const {
+    return job && job->finished;
+}
+
+size_t DirSizer::count() const {
+    return job ? job->names.size() : 0;
+}
+
+const std::string &DirSizer::name(size_t i) const {
+    return job->names[i];
+}
+
+int64_t DirSizer::total(size_t i) const {
+    return job->totals[i];
+}
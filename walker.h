@@ -0,0 +1,98 @@
+#ifndef WALKER_H_INCLUDED
+#define WALKER_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// What the walker knows about one entry. The stat fields are only valid when
+// hasStat is set, which is always the case with WalkOptions::statEntries.
+struct WalkEntry {
+    const std::string *dirPath;  // directory the entry is in
+    const char *name;
+    size_t nameLength;
+    uint8_t type;   // EntryType
+    int depth;      // 1 for entries directly under a root
+    uint32_t root;  // index of the root it was found under
+    bool hasStat;
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t nlink;
+    uint32_t mode;
+    int64_t size;
+    int64_t mtime;
+    int64_t mtimeNs;  // as readDirectoryStamp() gives them; not from an index
+    int64_t ctimeNs;
+};
+
+class TreeIndex;
+
+struct WalkOptions {
+    int maxDepth = -1;           // deepest entries to visit, -1 for no limit
+    bool oneFileSystem = false;  // don't descend into other mounts (st_dev)
+    bool statEntries = false;    // stat every entry, not only those readdir can't type
+    unsigned threads = 0;        // 0 for walkerThreads()
+
+    // Directories this index holds, and which haven't changed since, are
+    // listed from it rather than read; their entries come with stat data
+    const TreeIndex *index = nullptr;
+
+    // Called on the worker threads, concurrently, for each directory that
+    // couldn't be opened or read, with its path and an errno value. The walk
+    // carries on without what is below it.
+    std::function<void(const std::string &path, int error)> onError;
+};
+
+// Called on the worker threads, concurrently, for every entry found
+typedef std::function<void(const WalkEntry &entry)> WalkVisitor;
+
+// Default number of walker threads; more than the core count, since walking
+// is mostly waiting on metadata round trips
+unsigned walkerThreads();
+
+// Walk the trees under roots in parallel and return once all of them have
+// been visited, or soon after cancelled becomes true. Each worker thread
+// keeps its own deque of directories, takes work depth first from its back
+// and steals from the front of the others when it runs dry. Symbolic links
+// are reported but not followed.
+void walkTrees(const std::vector<std::string> &roots, const WalkOptions &options, const WalkVisitor &visit,
+               const std::atomic<bool> &cancelled);
+
+struct SizeJob;
+
+// Recursive sizes of some of the entries of a directory, computed on a
+// background thread with walkTrees(). Totals are the sum of the sizes of the
+// files below each entry, with hard linked files counted once. Directories
+// a TreeIndex has, and that are unchanged, are sized from it.
+class DirSizer {
+public:
+    ~DirSizer();
+
+    // Start sizing dirPath/name for each of names, cancelling any earlier job
+    void start(const std::string &dirPath, const std::vector<std::string> &names,
+               std::shared_ptr<const TreeIndex> index);
+    void cancel();
+
+    // True while a job has been started and not yet collected by finished()
+    bool active() const { return job != nullptr; }
+
+    // True once the walk is over; the totals are final then
+    bool finished() const;
+
+    // Totals so far, in the order the names were passed to start()
+    size_t count() const;
+    const std::string &name(size_t i) const;
+    int64_t total(size_t i) const;
+
+    // Forget the job once its results have been used
+    void clear() { job.reset(); }
+
+private:
+    std::shared_ptr<SizeJob> job;
+};
+
+#endif // WALKER_H_INCLUDED
@@ -0,0 +1,362 @@
+#include "watcher.h"
+
+#include "events.h"
+
+#include <string_view>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef O_EVTONLY
+#define O_EVTONLY O_RDONLY
+#endif
+#endif
+
+#if defined(_WIN32)
+// ReadDirectoryChangesW runs on its own thread with overlapped I/O, so it can be
+// stopped, and queues what it sees for poll()
+struct WatchState {
+    HANDLE dir = INVALID_HANDLE_VALUE;
+    HANDLE stopEvent = NULL;
+    std::thread thread;
+    std::mutex mutex;
+    std::vector<WatchEvent> pending;
+};
+
+static std::string narrowName(const WCHAR *name, DWORD bytes) {
+    int length = (int)(bytes / sizeof(WCHAR));
+    int size = WideCharToMultiByte(CP_ACP, 0, name, length, NULL, 0, NULL, NULL);
+    std::string result(size, '\0');
+    WideCharToMultiByte(CP_ACP, 0, name, length, &result[0], size, NULL, NULL);
+    return result;
+}
+
+static void watchThread(WatchState *state) {
+    DWORD buffer[16384];  // DWORD aligned, as ReadDirectoryChangesW requires
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                         FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+
+    while (true) {
+        ResetEvent(overlapped.hEvent);
+        if (!ReadDirectoryChangesW(state->dir, buffer, sizeof(buffer), FALSE, filter, NULL, &overlapped, NULL)) {
+            break;
+        }
+        HANDLE handles[2] = {overlapped.hEvent, state->stopEvent};
+        DWORD bytes = 0;
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            CancelIo(state->dir);
+            GetOverlappedResult(state->dir, &overlapped, &bytes, TRUE);
+            break;
+        }
+        if (!GetOverlappedResult(state->dir, &overlapped, &bytes, FALSE)) {
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (bytes == 0) {
+            state->pending.push_back({WATCH_RESCAN, ""});  // the change buffer overflowed
+            wakeUi();
+            continue;
+        }
+        const char *p = (const char *)buffer;
+        while (true) {
+            const FILE_NOTIFY_INFORMATION *info = (const FILE_NOTIFY_INFORMATION *)p;
+            WatchEventType type = WATCH_MODIFIED;
+            if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+                type = WATCH_ADDED;
+            } else if (info->Action == FILE_ACTION_REMOVED || info->Action == FILE_ACTION_RENAMED_OLD_NAME) {
+                type = WATCH_REMOVED;
+            }
+            state->pending.push_back({type, narrowName(info->FileName, info->FileNameLength)});
+            if (info->NextEntryOffset == 0) {
+                break;
+            }
+            p += info->NextEntryOffset;
+        }
+        wakeUi();
+    }
+    CloseHandle(overlapped.hEvent);
+}
+
+DirWatcher::DirWatcher() : state(new WatchState) {
+}
+
+bool DirWatcher::watch(const std::string &path) {
+    stop();
+    state->dir = CreateFileA(path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (state->dir == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    state->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    state->thread = std::thread(watchThread, state.get());
+    return true;
+}
+
+void DirWatcher::stop() {
+    if (state->thread.joinable()) {
+        SetEvent(state->stopEvent);
+        state->thread.join();
+    }
+    if (state->stopEvent) {
+        CloseHandle(state->stopEvent);
+        state->stopEvent = NULL;
+    }
+    if (state->dir != INVALID_HANDLE_VALUE) {
+        CloseHandle(state->dir);
+        state->dir = INVALID_HANDLE_VALUE;
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->pending.clear();
+}
+
+bool DirWatcher::active() const {
+    return state->dir != INVALID_HANDLE_VALUE;
+}
+
+void DirWatcher::poll(std::vector<WatchEvent> &events) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    events.insert(events.end(), state->pending.begin(), state->pending.end());
+    state->pending.clear();
+}
+
+int DirWatcher::descriptor() const {
+    return -1;
+}
+
+#elif defined(__linux__)
+struct WatchState {
+    int fd = -1;   // inotify instance
+    int wd = -1;   // watch on the current directory
+};
+
+DirWatcher::DirWatcher() : state(new WatchState) {
+    state->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+bool DirWatcher::watch(const std::string &path) {
+    stop();
+    if (state->fd < 0) {
+        return false;
+    }
+    state->wd = inotify_add_watch(state->fd, path.c_str(),
+                                  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |
+                                  IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    return state->wd >= 0;
+}
+
+void DirWatcher::stop() {
+    if (state->wd >= 0) {
+        inotify_rm_watch(state->fd, state->wd);
+        state->wd = -1;
+    }
+}
+
+bool DirWatcher::active() const {
+    return state->wd >= 0;
+}
+
+int DirWatcher::descriptor() const {
+    return state->fd;
+}
+
+void DirWatcher::poll(std::vector<WatchEvent> &events) {
+    if (state->fd < 0) {
+        return;
+    }
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    while (true) {
+        ssize_t length = read(state->fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;  // EAGAIN: nothing more queued
+        }
+        for (char *p = buffer; p < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                events.push_back({WATCH_RESCAN, ""});
+                continue;
+            }
+            if (event->wd != state->wd) {
+                continue;  // left over from a directory we no longer watch
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                events.push_back({WATCH_RESCAN, ""});
+            } else if (event->len == 0) {
+                continue;
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                events.push_back({WATCH_ADDED, event->name});
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                events.push_back({WATCH_REMOVED, event->name});
+            } else {
+                events.push_back({WATCH_MODIFIED, event->name});
+            }
+        }
+    }
+}
+
+#else
+// kqueue only says that the directory changed, not what changed
+struct WatchState {
+    int kq = -1;
+    int dirFd = -1;
+};
+
+DirWatcher::DirWatcher() : state(new WatchState) {
+    state->kq = kqueue();
+}
+
+bool DirWatcher::watch(const std::string &path) {
+    stop();
+    if (state->kq < 0) {
+        return false;
+    }
+    state->dirFd = open(path.c_str(), O_EVTONLY);
+    if (state->dirFd < 0) {
+        return false;
+    }
+    struct kevent change;
+    EV_SET(&change, state->dirFd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+           NOTE_WRITE | NOTE_DELETE | NOTE_RENAME | NOTE_ATTRIB | NOTE_EXTEND, 0, 0);
+    if (kevent(state->kq, &change, 1, NULL, 0, NULL) < 0) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void DirWatcher::stop() {
+    if (state->dirFd >= 0) {
+        close(state->dirFd);  // also removes the kevent
+        state->dirFd = -1;
+    }
+}
+
+bool DirWatcher::active() const {
+    return state->dirFd >= 0;
+}
+
+int DirWatcher::descriptor() const {
+    return state->kq;
+}
+
+void DirWatcher::poll(std::vector<WatchEvent> &events) {
+    if (state->dirFd < 0) {
+        return;
+    }
+    struct kevent fired[8];
+    struct timespec noWait = {0, 0};
+    if (kevent(state->kq, NULL, 0, fired, 8, &noWait) > 0) {
+        events.push_back({WATCH_RESCAN, ""});
+    }
+}
+#endif
+
+DirWatcher::~DirWatcher() {
+    stop();
+#if defined(__linux__)
+    if (state->fd >= 0) {
+        close(state->fd);
+    }
+#elif !defined(_WIN32)
+    if (state->kq >= 0) {
+        close(state->kq);
+    }
+#endif
+}
+
+// Net effect of the events on one name
+struct NameChange {
+    WatchEventType type;
+    bool seen;  // the name is already in the listing
+};
+
+// Copy the names of the listing's entries into a new arena, leaving out those
+// of entries that have gone
+static void compactNames(DirListing &listing, size_t liveBytes) {
+    std::string names;
+    names.reserve(liveBytes);
+    for (DirEntry &entry : listing.entries) {
+        std::string_view name = listing.nameView(entry);
+        entry.nameOffset = (uint32_t)names.size();
+        names.append(name.data(), name.size());
+        names.push_back('\0');
+    }
+    listing.names.swap(names);
+}
+
+bool applyWatchEvents(DirListing &listing, const std::vector<WatchEvent> &events, std::vector<int32_t> &remap,
+                      bool &added) {
+    added = false;
+    std::unordered_map<std::string_view, NameChange> changes;
+    for (const WatchEvent &event : events) {
+        if (event.type == WATCH_RESCAN) {
+            continue;  // the caller reloads instead
+        }
+        auto found = changes.find(event.name);
+        if (found == changes.end()) {
+            changes.emplace(event.name, NameChange{event.type, false});
+        } else if (event.type != WATCH_MODIFIED) {
+            found->second.type = event.type;  // a later create or delete decides
+        }
+    }
+    if (changes.empty()) {
+        return false;
+    }
+
+    // One pass over the entries: drop removed ones, flag changed ones for a new stat
+    std::vector<size_t> restat;
+    size_t kept = 0;
+    size_t liveBytes = 0;
+    remap.assign(listing.entries.size(), -1);
+    for (size_t i = 0; i < listing.entries.size(); i++) {
+        DirEntry entry = listing.entries[i];
+        auto found = changes.find(listing.nameView(entry));
+        if (found != changes.end()) {
+            found->second.seen = true;
+            if (found->second.type == WATCH_REMOVED) {
+                continue;
+            }
+            entry.flags &= ENTRY_MARKED;
+            restat.push_back(kept);
+        }
+        remap[i] = (int32_t)kept;
+        listing.entries[kept++] = entry;
+        liveBytes += entry.nameLength + 1;
+    }
+    listing.entries.resize(kept);
+
+    // Names of removed entries stay in the arena; in a directory whose files
+    // come and go all the time they would pile up without end
+    if (listing.names.size() - liveBytes > liveBytes) {
+        compactNames(listing, liveBytes);
+    }
+
+    for (const auto &change : changes) {
+        if (change.second.type == WATCH_ADDED && !change.second.seen) {
+            addEntry(listing, change.first, ENTRY_UNKNOWN);
+            restat.push_back(listing.entries.size() - 1);
+            added = true;
+        }
+    }
+    for (size_t index : restat) {
+        fillMetadata(listing, index, index + 1);
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef WATCHER_H_INCLUDED
+#define WATCHER_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "listing.h"
+
+enum WatchEventType {
+    WATCH_ADDED,     // created, or renamed into the directory
+    WATCH_REMOVED,   // deleted, or renamed out of the directory
+    WATCH_MODIFIED,  // contents or attributes changed
+    WATCH_RESCAN     // something changed but the backend can't say what
+};
+
+struct WatchEvent {
+    WatchEventType type;
+    std::string name;  // empty for WATCH_RESCAN
+};
+
+struct WatchState;
+
+// Watches one directory for changes: inotify on Linux, kqueue on macOS and
+// the BSDs, ReadDirectoryChangesW on Windows.
+class DirWatcher {
+public:
+    DirWatcher();
+    ~DirWatcher();
+    DirWatcher(const DirWatcher &) = delete;
+    DirWatcher &operator=(const DirWatcher &) = delete;
+
+    // Watch path instead of whatever was watched before; false if it can't be watched
+    bool watch(const std::string &path);
+    void stop();
+    bool active() const;
+
+    // Append the changes seen since the last call to events, without blocking
+    void poll(std::vector<WatchEvent> &events);
+
+    // Descriptor that becomes readable when there is something for poll(), or
+    // -1 where there is none: the Windows watcher calls wakeUi() instead
+    int descriptor() const;
+
+private:
+    std::unique_ptr<WatchState> state;
+};
+
+// Apply watch events to a listing in place. New and modified entries are
+// stat'ed again, and new ones appended. remap is set to the new index of each
+// entry that was there before, or -1 for those removed, and added to true if
+// entries were appended, as for a rename. Returns true if the listing changed.
+bool applyWatchEvents(DirListing &listing, const std::vector<WatchEvent> &events, std::vector<int32_t> &remap,
+                      bool &added);
+
+#endif // WATCHER_H_INCLUDED